@@ -44,6 +44,7 @@ namespace orig {
     static void (*SDL1_GetClipRect)(SDL1::SDL_Surface *surface, SDL1::SDL_Rect *rect);
     static int (*SDL_SetAlpha)(SDL1::SDL_Surface *surface, Uint32 flag, Uint8 alpha);
     static SDL1::SDL_Surface *(*SDL_DisplayFormat)(SDL1::SDL_Surface *surface);
+    static void* (*glXGetCurrentContext)(void);
 }
 
 DECLARE_ORIG_POINTER(SDL_RenderReadPixels);
@@ -79,6 +80,15 @@ DECLARE_ORIG_POINTER(glDisable);
 DECLARE_ORIG_POINTER(glIsEnabled);
 DECLARE_ORIG_POINTER(glGetIntegerv);
 DECLARE_ORIG_POINTER(glGetError);
+DECLARE_ORIG_POINTER(glGenBuffers);
+DECLARE_ORIG_POINTER(glDeleteBuffers);
+DECLARE_ORIG_POINTER(glBindBuffer);
+DECLARE_ORIG_POINTER(glBufferData);
+DECLARE_ORIG_POINTER(glMapBufferRange);
+DECLARE_ORIG_POINTER(glUnmapBuffer);
+DECLARE_ORIG_POINTER(glFenceSync);
+DECLARE_ORIG_POINTER(glClientWaitSync);
+DECLARE_ORIG_POINTER(glDeleteSync);
 
 #ifdef LIBTAS_HAS_VDPAU
 DECLARE_ORIG_POINTER(VdpOutputSurfaceGetParameters);
@@ -92,8 +102,7 @@ DEFINE_ORIG_POINTER(XGetGeometry);
 
 static bool inited = false;
 
-/* Temporary pixel arrays */
-static std::vector<uint8_t> glpixels;
+/* Temporary pixel array */
 static std::vector<uint8_t> winpixels;
 
 /* Video dimensions */
@@ -107,6 +116,21 @@ static GLuint screenFBO = 0;
 /* OpenGL render buffer */
 static GLuint screenRBO = 0;
 
+/* Ring of OpenGL pixel buffers, so that the readback of a frame is collected
+ * two frames later, without waiting for the GPU to finish rendering.
+ */
+#define PBO_COUNT 3
+static GLuint screenPBOs[PBO_COUNT] = {0};
+
+/* Fence inserted after each readback, or nullptr for a non-draw frame which
+ * reuses the previous pixels. */
+static GLsync screenFences[PBO_COUNT] = {nullptr};
+static bool screenDraws[PBO_COUNT];
+
+/* Index of the oldest pending readback, and number of pending readbacks */
+static int pbo_first = 0;
+static int pbo_pending = 0;
+
 /* SDL1 screen surface */
 static SDL1::SDL_Surface* screenSDL1Surf = nullptr;
 
@@ -308,7 +332,29 @@ void ScreenCapture::initScreenSurface()
         if ((error = orig::glGetError()) != GL_NO_ERROR)
             debuglogstdio(LCF_WINDOW | LCF_OGL | LCF_ERROR, "glBindFramebuffer failed with error %d", error);
 
-        glpixels.resize(size);
+        /* Generate the pixel buffers used for readback */
+        LINK_NAMESPACE(glGenBuffers, "GL");
+        LINK_NAMESPACE(glBindBuffer, "GL");
+        LINK_NAMESPACE(glBufferData, "GL");
+
+        GLint pack_buffer;
+        orig::glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pack_buffer);
+
+        if (screenPBOs[0] == 0) {
+            orig::glGenBuffers(PBO_COUNT, screenPBOs);
+            if ((error = orig::glGetError()) != GL_NO_ERROR)
+                debuglogstdio(LCF_WINDOW | LCF_OGL | LCF_ERROR, "glGenBuffers failed with error %d", error);
+        }
+        for (int i = 0; i < PBO_COUNT; i++) {
+            orig::glBindBuffer(GL_PIXEL_PACK_BUFFER, screenPBOs[i]);
+            orig::glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+            if ((error = orig::glGetError()) != GL_NO_ERROR)
+                debuglogstdio(LCF_WINDOW | LCF_OGL | LCF_ERROR, "glBufferData failed with error %d", error);
+        }
+        orig::glBindBuffer(GL_PIXEL_PACK_BUFFER, pack_buffer);
+
+        pbo_first = 0;
+        pbo_pending = 0;
     }
 
     else if (game_info.video & GameInfo::SDL1) {
@@ -327,10 +373,20 @@ void ScreenCapture::initScreenSurface()
 }
 
 
-void ScreenCapture::fini()
+void ScreenCapture::fini(void* context)
 {
+    /* Send the frames whose readback is still pending to the encoder. The
+     * pixel buffers can only be read if their context is current, which we
+     * only know for sure when a context is destroyed. */
+    if (avencoder && (pbo_pending > 0)) {
+        LINK_NAMESPACE(glXGetCurrentContext, "GL");
+        void* current = orig::glXGetCurrentContext ? orig::glXGetCurrentContext() : nullptr;
+        bool collect = current && (!context || (context == current));
+        GlobalNative gn;
+        avencoder->flushPendingFrames(collect);
+    }
+
     winpixels.clear();
-    glpixels.clear();
 
     destroyScreenSurface();
 
@@ -350,6 +406,26 @@ void ScreenCapture::destroyScreenSurface()
         orig::glDeleteRenderbuffers(1, &screenRBO);
         screenRBO = 0;
     }
+    if (screenPBOs[0] != 0) {
+        LINK_NAMESPACE(glDeleteBuffers, "GL");
+        LINK_NAMESPACE(glDeleteSync, "GL");
+
+        /* Pending readbacks are lost */
+        if (pbo_pending > 0)
+            debuglogstdio(LCF_WINDOW | LCF_OGL, "Dropping %d pending frame readbacks", pbo_pending);
+
+        for (int i = 0; i < PBO_COUNT; i++) {
+            if (screenFences[i]) {
+                orig::glDeleteSync(screenFences[i]);
+                screenFences[i] = nullptr;
+            }
+        }
+        orig::glDeleteBuffers(PBO_COUNT, screenPBOs);
+        for (int i = 0; i < PBO_COUNT; i++)
+            screenPBOs[i] = 0;
+        pbo_first = 0;
+        pbo_pending = 0;
+    }
 
     /* Delete the SDL1 screen surface */
     if (screenSDL1Surf) {
@@ -396,6 +472,13 @@ void ScreenCapture::resize(int w, int h)
         return;
     }
 
+    /* We need to close the dumping if needed, and open a new one. The
+     * encoder is closed first so that it collects the pending readbacks with
+     * the old dimensions. */
+    if (shared_config.av_dumping) {
+        avencoder.reset(nullptr);
+    }
+
     destroyScreenSurface();
 
     width = w;
@@ -407,7 +490,6 @@ void ScreenCapture::resize(int w, int h)
 
     initScreenSurface();
 
-    /* We need to close the dumping if needed, and open a new one */
     if (shared_config.av_dumping) {
         avencoder.reset(new AVEncoder());
     }
@@ -531,6 +613,110 @@ int ScreenCapture::storePixels()
     return getPixels(nullptr, true);
 }
 
+/* Start the readback of our FBO into the next pixel buffer. Non-draw frames
+ * also take a slot, so that pixels are returned in the same order as the
+ * calls were made.
+ */
+static void startReadback(bool draw)
+{
+    int slot = (pbo_first + pbo_pending) % PBO_COUNT;
+    screenDraws[slot] = draw;
+    screenFences[slot] = nullptr;
+    pbo_pending++;
+
+    if (!draw)
+        return;
+
+    LINK_NAMESPACE(glReadPixels, "GL");
+    LINK_NAMESPACE(glBindFramebuffer, "GL");
+    LINK_NAMESPACE(glBindBuffer, "GL");
+    LINK_NAMESPACE(glFenceSync, "GL");
+    LINK_NAMESPACE(glGetIntegerv, "GL");
+
+    GLenum error;
+
+    GLint read_buffer, pack_buffer;
+    orig::glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_buffer);
+    orig::glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pack_buffer);
+
+    orig::glGetError();
+    orig::glBindFramebuffer(GL_READ_FRAMEBUFFER, screenFBO);
+    if ((error = orig::glGetError()) != GL_NO_ERROR)
+        debuglogstdio(LCF_WINDOW | LCF_OGL | LCF_ERROR, "glBindFramebuffer failed with error %d", error);
+
+    /* The read is queued into the pixel buffer and returns immediately */
+    orig::glBindBuffer(GL_PIXEL_PACK_BUFFER, screenPBOs[slot]);
+    orig::glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    if ((error = orig::glGetError()) != GL_NO_ERROR)
+        debuglogstdio(LCF_WINDOW | LCF_OGL | LCF_ERROR, "glReadPixels failed with error %d", error);
+
+    screenFences[slot] = orig::glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    orig::glBindBuffer(GL_PIXEL_PACK_BUFFER, pack_buffer);
+    orig::glBindFramebuffer(GL_READ_FRAMEBUFFER, read_buffer);
+    if ((error = orig::glGetError()) != GL_NO_ERROR)
+        debuglogstdio(LCF_WINDOW | LCF_OGL | LCF_ERROR, "glBindFramebuffer failed with error %d", error);
+}
+
+/* Collect the oldest pending readback into winpixels.
+ * Returns the size of the array, or 0 if no readback is pending.
+ */
+static int collectReadback()
+{
+    if (pbo_pending == 0)
+        return 0;
+
+    int slot = pbo_first;
+    pbo_first = (pbo_first + 1) % PBO_COUNT;
+    pbo_pending--;
+
+    /* Non-draw frame: keep the previous pixels */
+    if (!screenDraws[slot])
+        return size;
+
+    LINK_NAMESPACE(glBindBuffer, "GL");
+    LINK_NAMESPACE(glMapBufferRange, "GL");
+    LINK_NAMESPACE(glUnmapBuffer, "GL");
+    LINK_NAMESPACE(glClientWaitSync, "GL");
+    LINK_NAMESPACE(glDeleteSync, "GL");
+    LINK_NAMESPACE(glGetIntegerv, "GL");
+
+    /* The readback was queued two frames ago, so this should not block */
+    if (screenFences[slot]) {
+        GLenum ret = orig::glClientWaitSync(screenFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        if ((ret == GL_TIMEOUT_EXPIRED) || (ret == GL_WAIT_FAILED))
+            debuglogstdio(LCF_WINDOW | LCF_OGL | LCF_ERROR, "glClientWaitSync failed with return %d", ret);
+        orig::glDeleteSync(screenFences[slot]);
+        screenFences[slot] = nullptr;
+    }
+
+    GLint pack_buffer;
+    orig::glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pack_buffer);
+
+    orig::glBindBuffer(GL_PIXEL_PACK_BUFFER, screenPBOs[slot]);
+    const uint8_t* glpixels = static_cast<const uint8_t*>(orig::glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT));
+
+    if (glpixels) {
+        /*
+         * Flip image vertically while copying out of the pixel buffer
+         * This is because OpenGL has a different reference point
+         * Code taken from http://stackoverflow.com/questions/5862097/sdl-opengl-screenshot-is-black
+         */
+        for (int line = 0; line < height; line++) {
+            int pos = line * pitch;
+            memcpy(&winpixels[pos], &glpixels[(size-pos)-pitch], pitch);
+        }
+        orig::glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    else {
+        debuglogstdio(LCF_WINDOW | LCF_OGL | LCF_ERROR, "glMapBufferRange failed");
+    }
+
+    orig::glBindBuffer(GL_PIXEL_PACK_BUFFER, pack_buffer);
+
+    return size;
+}
+
 int ScreenCapture::getPixels(uint8_t **pixels, bool draw)
 {
     if (!inited)
@@ -540,11 +726,17 @@ int ScreenCapture::getPixels(uint8_t **pixels, bool draw)
         *pixels = winpixels.data();
     }
 
-    if (!draw)
-        return size;
-
     GlobalNative gn;
 
+    if (!draw) {
+        /* Non-draw frames still go through the OpenGL readback pipeline */
+        if (pixels && screenPBOs[0] != 0) {
+            startReadback(false);
+            return (pbo_pending < PBO_COUNT) ? 0 : collectReadback();
+        }
+        return size;
+    }
+
     if (game_info.video & GameInfo::VDPAU) {
 #ifdef LIBTAS_HAS_VDPAU
         /* Copy to our screen surface */
@@ -612,7 +804,6 @@ int ScreenCapture::getPixels(uint8_t **pixels, bool draw)
     }
 
     else if (game_info.video & GameInfo::OPENGL) {
-        LINK_NAMESPACE(glReadPixels, "GL");
         LINK_NAMESPACE(glBindFramebuffer, "GL");
         LINK_NAMESPACE(glBlitFramebuffer, "GL");
         LINK_NAMESPACE(glEnable, "GL");
@@ -654,35 +845,15 @@ int ScreenCapture::getPixels(uint8_t **pixels, bool draw)
         if ((error = orig::glGetError()) != GL_NO_ERROR)
             debuglogstdio(LCF_WINDOW | LCF_OGL | LCF_ERROR, "glBindFramebuffer failed with error %d", error);
 
-        if (pixels) {
-
-            /* We need to recover the pixels for encoding */
-            orig::glBindFramebuffer(GL_READ_FRAMEBUFFER, screenFBO);
-            if ((error = orig::glGetError()) != GL_NO_ERROR)
-                debuglogstdio(LCF_WINDOW | LCF_OGL | LCF_ERROR, "glBindFramebuffer failed with error %d", error);
-
-            orig::glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, glpixels.data());
-            if ((error = orig::glGetError()) != GL_NO_ERROR)
-                debuglogstdio(LCF_WINDOW | LCF_OGL | LCF_ERROR, "glReadPixels failed with error %d", error);
-
-            orig::glBindFramebuffer(GL_READ_FRAMEBUFFER, read_buffer);
-            if ((error = orig::glGetError()) != GL_NO_ERROR)
-                debuglogstdio(LCF_WINDOW | LCF_OGL | LCF_ERROR, "glReadPixels failed with error %d", error);
-
-            /*
-             * Flip image horizontally
-             * This is because OpenGL has a different reference point
-             * Code taken from http://stackoverflow.com/questions/5862097/sdl-opengl-screenshot-is-black
-             */
-
-            for (int line = 0; line < height; line++) {
-                int pos = line * pitch;
-                memcpy(&winpixels[pos], &glpixels[(size-pos)-pitch], pitch);
-            }
-        }
-
         if (isFramebufferSrgb)
             orig::glEnable(GL_FRAMEBUFFER_SRGB);
+
+        if (pixels) {
+            /* We need to recover the pixels for encoding. The readback is
+             * queued, and we return the one started two frames ago. */
+            startReadback(true);
+            return (pbo_pending < PBO_COUNT) ? 0 : collectReadback();
+        }
     }
 
     else if (game_info.video & GameInfo::SDL1) {
@@ -742,6 +913,20 @@ int ScreenCapture::getPixels(uint8_t **pixels, bool draw)
     return size;
 }
 
+int ScreenCapture::flushPixels(uint8_t **pixels)
+{
+    if (!inited)
+        return 0;
+
+    if (pixels) {
+        *pixels = winpixels.data();
+    }
+
+    GlobalNative gn;
+
+    return collectReadback();
+}
+
 int ScreenCapture::setPixels() {
     if (!inited)
         return 0;
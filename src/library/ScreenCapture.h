@@ -36,8 +36,10 @@ int init();
 /* Create the screen buffer/surface/texture */
 void initScreenSurface();
 
-/* Called when screen is closed */
-void fini();
+/* Called when screen is closed. When an OpenGL context is destroyed, it is
+ * passed so that pending readbacks are only collected from the current one.
+ */
+void fini(void* context = nullptr);
 
 /* Destroy the screen buffer/surface/texture */
 void destroyScreenSurface();
@@ -58,9 +60,18 @@ int storePixels();
 
 /* Capture the pixels from the screen and copy a pointer to this array into pixels.
  * Returns the size of the array.
+ * For OpenGL games, the readback is asynchronous: the pixels returned belong
+ * to the call made two calls earlier, and 0 is returned while the readback
+ * pipeline is filling up.
  */
 int getPixels(uint8_t **pixels, bool draw);
 
+/* Get the pixels of the oldest readback that is still pending, and copy a
+ * pointer to this array into pixels. Returns the size of the array, or 0 if
+ * no readback is pending.
+ */
+int flushPixels(uint8_t **pixels);
+
 /* Set the screen pixels from our buffers. */
 int setPixels();
 
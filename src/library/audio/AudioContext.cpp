@@ -21,9 +21,15 @@
 #include "AudioContext.h"
 #include "AudioPlayer.h"
 #include "../global.h" // shared_config
+#include "MixKernels.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #define MAXBUFFERS 2048 // Max I've seen so far: 960
 #define MAXSOURCES 256 // Max I've seen so far: 112
+#define MAXMIXTHREADS 4
+#define MINPARALLELSOURCES 32
 
 namespace libtas {
 
@@ -62,6 +68,41 @@ static struct timespec samplesToTicks(int nbSamples, int frequency)
     return ticks;
 }
 
+/* Helper function to check if a source can be mixed by a worker thread.
+ * Callback sources run game code, and MS-ADPCM buffers decode their samples
+ * inside the buffer object, which can be shared between sources. */
+static bool isIndependentSource(const AudioSource& source)
+{
+    if (source.state != AudioSource::SOURCE_PLAYING)
+        return false;
+    if (source.source == AudioSource::SOURCE_CALLBACK)
+        return false;
+    for (const auto& buffer : source.buffer_queue) {
+        if (buffer->format == AudioBuffer::SAMPLE_FMT_MSADPCM)
+            return false;
+    }
+    return true;
+}
+
+/* Helper function to fill a buffer with triangular (TPDF) dither noise of
+ * one unit of amplitude. The noise comes from a xorshift generator with a
+ * fixed seed, so that the audio output is deterministic. */
+static void fillDither(std::vector<float>& dither, int count)
+{
+    static uint32_t state = 0x9e3779b9;
+    dither.resize(count);
+    for (int i = 0; i < count; i++) {
+        uint32_t r[2];
+        for (int j = 0; j < 2; j++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            r[j] = state >> 8;
+        }
+        dither[i] = (static_cast<float>(r[0]) - static_cast<float>(r[1])) / 16777216.0f;
+    }
+}
+
 
 AudioContext::AudioContext(void)
 {
@@ -210,11 +251,9 @@ void AudioContext::mixAllSources(struct timespec ticks)
 
     debuglog(LCF_SOUND, "Start mixing about ", outNbSamples, " samples");
 
-    /* Silent the output buffer */
-    if (outBitDepth == 8) // Unsigned 8-bit samples
-        outSamples.assign(outBytes, 0x80);
-    if (outBitDepth == 16) // Signed 16-bit samples
-        outSamples.assign(outBytes, 0);
+    /* Silent the mix bus */
+    mixBus.assign(outNbSamples * outNbChannels, 0.0f);
+    outSamples.resize(outBytes);
 
     pthread_t mix_thread = ThreadManager::getThreadId();
 
@@ -245,15 +284,102 @@ void AudioContext::mixAllSources(struct timespec ticks)
             }
         }
         audiocontext.mutex.unlock();
+    }
 
+    {
         std::lock_guard<std::mutex> lock(mutex);
-        source->mixWith(ticks, &outSamples[0], outBytes, outBitDepth, outNbChannels, outFrequency, outVolume);
+
+        int nbIndependent = 0;
+        for (auto& source : sources) {
+            if (isIndependentSource(*source))
+                nbIndependent++;
+        }
+
+        if (mixWorkers && (nbIndependent >= MINPARALLELSOURCES)) {
+            mixSourcesParallel(ticks);
+        }
+        else {
+            for (auto& source : sources)
+                source->mixWith(ticks, mixBus.data(), outNbSamples, outNbChannels, outFrequency, outVolume);
+        }
     }
 
+    /* Convert the mix bus into the output format */
+    int count = outNbSamples * outNbChannels;
+    fillDither(dither, count);
+    int saturated = 0;
+    if (outBitDepth == 8) // Unsigned 8-bit samples
+        saturated = convertSamplesU8(outSamples.data(), mixBus.data(), dither.data(), count);
+    if (outBitDepth == 16) // Signed 16-bit samples
+        saturated = convertSamplesS16(reinterpret_cast<int16_t*>(outSamples.data()), mixBus.data(), dither.data(), count);
+
+    if (saturated > 0)
+        debuglog(LCF_SOUND | LCF_WARNING, "Saturation during mixing of ", saturated, " samples");
+
     if (!audiocontext.isLoopback && !shared_config.audio_mute) {
         /* Play the music */
         AudioPlayer::play(*this);
     }
 }
 
+void AudioContext::mixSourcesParallel(struct timespec ticks)
+{
+    int count = outNbSamples * outNbChannels;
+    int nbSources = sources.size();
+
+    /* Sources are classified before mixing, because mixing changes their state */
+    std::vector<AudioSource*> sourceList;
+    std::vector<int> independents;
+    std::vector<int> dependents;
+    std::vector<int> mixedSamples(nbSources, 0);
+    sourceList.reserve(nbSources);
+    sourceBuses.resize(nbSources);
+
+    for (auto& source : sources) {
+        int i = sourceList.size();
+        sourceList.push_back(source.get());
+        if (source->state == AudioSource::SOURCE_PLAYING)
+            sourceBuses[i].assign(count, 0.0f);
+        if (isIndependentSource(*source))
+            independents.push_back(i);
+        else
+            dependents.push_back(i);
+    }
+
+    /* Workers pick the next independent source until there is none left */
+    std::atomic<int> next(0);
+    auto mixIndependents = [&]() {
+        for (int j = next++; j < static_cast<int>(independents.size()); j = next++) {
+            int i = independents[j];
+            mixedSamples[i] = sourceList[i]->mixWith(ticks, sourceBuses[i].data(), outNbSamples, outNbChannels, outFrequency, outVolume);
+        }
+    };
+
+    /* Other sources are mixed by this thread before waking the workers */
+    for (int i : dependents)
+        mixedSamples[i] = sourceList[i]->mixWith(ticks, sourceBuses[i].data(), outNbSamples, outNbChannels, outFrequency, outVolume);
+    mixWorkers->run(mixIndependents);
+
+    /* Each source buffer holds exactly what would have been added to the mix
+     * bus when mixing serially, so the result is also the same. */
+    for (int i = 0; i < nbSources; i++) {
+        if (mixedSamples[i] > 0)
+            mixSamplesFloat(mixBus.data(), sourceBuses[i].data(), mixedSamples[i] * outNbChannels, 1.0f);
+    }
+}
+
+void AudioContext::startMixWorkers()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    int nbThreads = std::min(static_cast<int>(std::thread::hardware_concurrency()) / 2, MAXMIXTHREADS);
+    if (!mixWorkers && (nbThreads > 1))
+        mixWorkers.reset(new MixWorkers(nbThreads));
+}
+
+void AudioContext::stopMixWorkers()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    mixWorkers.reset(nullptr);
+}
+
 }
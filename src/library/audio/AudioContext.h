@@ -26,6 +26,7 @@
 #include <mutex>
 #include "AudioBuffer.h"
 #include "AudioSource.h"
+#include "MixWorkers.h"
 
 namespace libtas {
 /* This class stores a set of audio sources and audio buffers, and
@@ -60,6 +61,13 @@ class AudioContext
         /* Mixed buffer during a frame */
         std::vector<uint8_t> outSamples;
 
+        /* Float buffer where all sources are mixed, before being converted
+         * into outSamples */
+        std::vector<float> mixBus;
+
+        /* Dither noise added during the conversion of the mix bus */
+        std::vector<float> dither;
+
         /* Size of the mixed buffer in samples */
         int outNbSamples;
 
@@ -100,6 +108,17 @@ class AudioContext
         void mixAllSources(struct timespec ticks);
         void mixAllSources(int nbSamples);
 
+        /* Mix sources using worker threads. Each source is mixed in its own
+         * buffer, which are added to the mix bus in the order of the source
+         * list, so that the result does not depend on the number of threads */
+        void mixSourcesParallel(struct timespec ticks);
+
+        /* Start and stop the threads that mix sources in parallel. They are
+         * kept for the duration of an encode, outside of which sources are
+         * mixed by the calling thread only. */
+        void startMixWorkers();
+        void stopMixWorkers();
+
         /* Mutex to protect access to all audio objects */
         std::mutex mutex;
 
@@ -113,6 +132,12 @@ class AudioContext
         /* Extra buffers and sources that have been deleted and can be recycled */
         std::list<std::shared_ptr<AudioBuffer>> buffers_pool;
         std::list<std::shared_ptr<AudioSource>> sources_pool;
+
+        /* Per-source buffers used when mixing sources in parallel */
+        std::vector<std::vector<float>> sourceBuses;
+
+        /* Threads that mix sources in parallel */
+        std::unique_ptr<MixWorkers> mixWorkers;
 };
 
 extern AudioContext audiocontext;
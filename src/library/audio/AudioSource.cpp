@@ -18,6 +18,7 @@
  */
 
 #include "AudioSource.h"
+#include "MixKernels.h"
 #include <iterator>     // std::back_inserter
 #include <algorithm>    // std::copy
 #include "../logging.h"
@@ -72,6 +73,13 @@ AudioSource::AudioSource(void)
     /* We link to swr_free here, because linking during destructor can softlock */
     LINK_NAMESPACE(swr_free, "swresample");
 
+    /* We link to the mixing functions here, because sources can be mixed
+     * concurrently by worker threads */
+    LINK_NAMESPACE(swr_is_initialized, "swresample");
+    LINK_NAMESPACE(swr_init, "swresample");
+    LINK_NAMESPACE(swr_convert, "swresample");
+    LINK_NAMESPACE(swr_alloc_set_opts, "swresample");
+
     swr = orig::swr_alloc();
 
     volume = 1.0f;
@@ -195,13 +203,8 @@ bool AudioSource::willEnd(struct timespec ticks)
 }
 
 
-int AudioSource::mixWith( struct timespec ticks, uint8_t* outSamples, int outBytes, int outBitDepth, int outNbChannels, int outFrequency, float outVolume)
+int AudioSource::mixWith( struct timespec ticks, float* mixBus, int outNbSamples, int outNbChannels, int outFrequency, float outVolume)
 {
-    LINK_NAMESPACE(swr_is_initialized, "swresample");
-    LINK_NAMESPACE(swr_init, "swresample");
-    LINK_NAMESPACE(swr_convert, "swresample");
-    LINK_NAMESPACE(swr_alloc_set_opts, "swresample");
-
     if (state != SOURCE_PLAYING)
         return -1;
 
@@ -222,7 +225,6 @@ int AudioSource::mixWith( struct timespec ticks, uint8_t* outSamples, int outByt
         if (! orig::swr_is_initialized(swr)) {
             /* Get the sample format */
             AVSampleFormat inFormat = AV_SAMPLE_FMT_U8;
-            AVSampleFormat outFormat = AV_SAMPLE_FMT_U8;
             switch (curBuf->format) {
                 case AudioBuffer::SAMPLE_FMT_U8:
                     inFormat = AV_SAMPLE_FMT_U8;
@@ -244,10 +246,6 @@ int AudioSource::mixWith( struct timespec ticks, uint8_t* outSamples, int outByt
                     debuglog(LCF_SOUND | LCF_ERROR, "Unknown sample format");
                     break;
             }
-            if (outBitDepth == 8)
-                outFormat = AV_SAMPLE_FMT_U8;
-            if (outBitDepth == 16)
-                outFormat = AV_SAMPLE_FMT_S16;
 
             /* Get the channel layout */
             int64_t in_ch_layout = 0;
@@ -266,7 +264,9 @@ int AudioSource::mixWith( struct timespec ticks, uint8_t* outSamples, int outByt
                 out_ch_layout = AV_CH_LAYOUT_STEREO;
             }
 
-            MYASSERT(nullptr != orig::swr_alloc_set_opts(swr, out_ch_layout, outFormat, outFrequency, in_ch_layout, inFormat, static_cast<int>(curBuf->frequency*pitch), 0, nullptr));
+            /* Samples are always converted to float, the conversion to the
+             * output format is done once on the whole mix */
+            MYASSERT(nullptr != orig::swr_alloc_set_opts(swr, out_ch_layout, AV_SAMPLE_FMT_FLT, outFrequency, in_ch_layout, inFormat, static_cast<int>(curBuf->frequency*pitch), 0, nullptr));
 
             /* Open the context */
             if (orig::swr_init(swr) < 0) {
@@ -284,8 +284,6 @@ int AudioSource::mixWith( struct timespec ticks, uint8_t* outSamples, int outByt
      * TODO: This is where we can support panning.
      */
     float resultVolume = (volume * outVolume) > 1.0?1.0:(volume*outVolume);
-    int lvas = (int)(resultVolume * 65536.0f);
-    int rvas = (int)(resultVolume * 65536.0f);
 
     /* Number of samples to advance in the buffer. */
     int inNbSamples = ticksToSamples(ticks, static_cast<int>(curBuf->frequency*pitch));
@@ -294,8 +292,7 @@ int AudioSource::mixWith( struct timespec ticks, uint8_t* outSamples, int outByt
     int newPosition = position + inNbSamples;
 
     /* Allocate the mixed audio array */
-    int outNbSamples = outBytes / (outNbChannels * outBitDepth / 8);
-    mixedSamples.resize(outBytes);
+    mixedSamples.resize(outNbSamples * outNbChannels * sizeof(float));
     uint8_t* begMixed = mixedSamples.data();
 
     int convOutSamples = 0;
@@ -412,50 +409,8 @@ int AudioSource::mixWith( struct timespec ticks, uint8_t* outSamples, int outByt
     }
 
     if (!skipMixing) {
-        #define clamptofullsignedrange(x,lo,hi) ((static_cast<unsigned int>((x)-(lo))<=static_cast<unsigned int>((hi)-(lo)))?(x):(((x)<0)?(lo):(hi)))
-
-        /* Add mixed source to the output buffer */
-        if (outBitDepth == 8) {
-            for (int s=0; s<convOutSamples*outNbChannels; s+=outNbChannels) {
-                int myL = mixedSamples[s];
-                int otherL = outSamples[s];
-                int sumL = otherL + ((myL * lvas) >> 16) - 256;
-                outSamples[s] = clamptofullsignedrange(sumL, 0, UINT8_MAX);
-                if ((sumL < 0) || (sumL > UINT8_MAX))
-                    debuglog(LCF_SOUND | LCF_WARNING, "Saturation during mixing");
-
-                if (outNbChannels == 2) {
-                    int myR = mixedSamples[s+1];
-                    int otherR = outSamples[s+1];
-                    int sumR = otherR + ((myR * rvas) >> 16) - 256;
-                    outSamples[s+1] = clamptofullsignedrange(sumR, 0, UINT8_MAX);
-                    if ((sumR < 0) || (sumR > UINT8_MAX))
-                        debuglog(LCF_SOUND | LCF_WARNING, "Saturation during mixing");
-                }
-            }
-        }
-
-        if (outBitDepth == 16) {
-            int16_t* mixedSamples16 = reinterpret_cast<int16_t*>(mixedSamples.data());
-            int16_t* outSamples16 = reinterpret_cast<int16_t*>(outSamples);
-            for (int s=0; s<convOutSamples*outNbChannels; s+=outNbChannels) {
-                int myL = mixedSamples16[s];
-                int otherL = outSamples16[s];
-                int sumL = otherL + ((myL * lvas) >> 16);
-                outSamples16[s] = clamptofullsignedrange(sumL, INT16_MIN, INT16_MAX);
-                if ((sumL < INT16_MIN) || (sumL > INT16_MAX))
-                    debuglog(LCF_SOUND | LCF_WARNING, "Saturation during mixing");
-
-                if (outNbChannels == 2) {
-                    int myR = mixedSamples16[s+1];
-                    int otherR = outSamples16[s+1];
-                    int sumR = otherR + ((myR * rvas) >> 16);
-                    outSamples16[s+1] = clamptofullsignedrange(sumR, INT16_MIN, INT16_MAX);
-                    if ((sumR < INT16_MIN) || (sumR > INT16_MAX))
-                        debuglog(LCF_SOUND | LCF_WARNING, "Saturation during mixing");
-                }
-            }
-        }
+        /* Add mixed source to the mix bus */
+        mixSamplesFloat(mixBus, reinterpret_cast<const float*>(mixedSamples.data()), convOutSamples * outNbChannels, resultVolume);
     }
 
     return convOutSamples;
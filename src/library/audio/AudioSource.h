@@ -165,11 +165,12 @@ class AudioSource
         /* Check if reading a number of ticks will reach the end of the source */
         bool willEnd(struct timespec ticks);
 
-        /* Mix the buffer with an external buffer of the given format.
+        /* Add the buffer into a float mix bus of outNbSamples samples, with the
+         * given number of channels and frequency.
          * The number of samples to mix correspond to the number of ticks given.
-         * The function returns the number of samples written in the output buffer.
+         * The function returns the number of samples written in the mix bus.
          */
-        int mixWith( struct timespec ticks, uint8_t* outSamples, int outBytes, int outBitDepth, int outNbChannels, int outFrequency, float outVolume);
+        int mixWith( struct timespec ticks, float* mixBus, int outNbSamples, int outNbChannels, int outFrequency, float outVolume);
 };
 }
 
@@ -0,0 +1,71 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MixKernels.h"
+
+namespace libtas {
+
+/* The loops are written without branches so that they are vectorized. The
+ * library is built with -O2, which does not enable the vectorizer. */
+#define MIX_KERNEL __attribute__((target_clones("avx2", "default"), optimize("tree-vectorize")))
+
+MIX_KERNEL
+void mixSamplesFloat(float* out, const float* in, int count, float volume)
+{
+    for (int i = 0; i < count; i++)
+        out[i] += in[i] * volume;
+}
+
+/* Float samples use the same scale as swresample, s16/32768 and
+ * (u8-128)/128. Samples that are already integers in the output scale,
+ * like silence or integer sources at unity gain, are not dithered so that
+ * they are converted back exactly.
+ * Rounding is done by truncating the value offset to be positive, because
+ * rounding instructions are not available in SSE2 */
+MIX_KERNEL
+int convertSamplesS16(int16_t* out, const float* in, const float* dither, int count)
+{
+    int saturated = 0;
+    for (int i = 0; i < count; i++) {
+        float s = in[i] * 32768.0f;
+        saturated += (s < -32768.0f) | (s > 32767.0f);
+        s = (s < -32768.0f) ? -32768.0f : ((s > 32767.0f) ? 32767.0f : s);
+        float v = s + ((static_cast<float>(static_cast<int>(s)) != s) ? dither[i] : 0.0f);
+        v = (v < -32768.0f) ? -32768.0f : ((v > 32767.0f) ? 32767.0f : v);
+        out[i] = static_cast<int>(v + 32768.5f) - 32768;
+    }
+    return saturated;
+}
+
+MIX_KERNEL
+int convertSamplesU8(uint8_t* out, const float* in, const float* dither, int count)
+{
+    int saturated = 0;
+    for (int i = 0; i < count; i++) {
+        float s = in[i] * 128.0f;
+        saturated += (s < -128.0f) | (s > 127.0f);
+        s = (s < -128.0f) ? -128.0f : ((s > 127.0f) ? 127.0f : s);
+        float v = s + ((static_cast<float>(static_cast<int>(s)) != s) ? dither[i] : 0.0f);
+        v = (v < -128.0f) ? -128.0f : ((v > 127.0f) ? 127.0f : v);
+        out[i] = static_cast<int>(v + 128.5f);
+    }
+    return saturated;
+}
+
+}
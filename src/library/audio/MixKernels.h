@@ -0,0 +1,50 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_MIXKERNELS_H_INCL
+#define LIBTAS_MIXKERNELS_H_INCL
+
+#include <cstdint>
+
+namespace libtas {
+
+/* Kernels that mix the samples of sources into a float mix bus, and convert
+ * the mix bus into the output format.
+ *
+ * The kernels are compiled for AVX2 and the default SSE2, and the best one
+ * is selected at runtime. Both versions give the same result.
+ */
+
+/* Add float samples multiplied by a volume into the mix bus. The mix bus is
+ * not clamped, so that saturation only happens in the final conversion. */
+void mixSamplesFloat(float* out, const float* in, int count, float volume);
+
+/* Convert the mix bus into signed 16-bit samples, after adding a dither
+ * noise expressed in output units to the samples that are not already
+ * integers. The result is rounded and saturated.
+ * Returns the number of samples that saturated, so that saturation can be
+ * reported once per mix instead of per sample. */
+int convertSamplesS16(int16_t* out, const float* in, const float* dither, int count);
+
+/* Same for unsigned 8-bit samples, centered on 128 */
+int convertSamplesU8(uint8_t* out, const float* in, const float* dither, int count);
+
+}
+
+#endif
@@ -0,0 +1,100 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MixWorkers.h"
+
+#include "../logging.h"
+#include "../GlobalState.h"
+
+namespace libtas {
+
+MixWorkers::MixWorkers(int nbThreads)
+{
+    /* Workers are not game threads, so they must not be registered by our
+     * pthread_create hook. */
+    for (int t = 1; t < nbThreads; t++)
+        NATIVECALL(workers.emplace_back(&MixWorkers::workerLoop, this));
+}
+
+MixWorkers::~MixWorkers()
+{
+    GlobalNative gn;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    task_cond.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+int MixWorkers::size()
+{
+    return workers.size() + 1;
+}
+
+void MixWorkers::run(const Task& task)
+{
+    {
+        GlobalNative gn;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->task = &task;
+            task_number++;
+            running = workers.size();
+        }
+        task_cond.notify_all();
+    }
+
+    /* The calling thread runs the task outside of native mode, like
+     * before the pool existed */
+    task();
+
+    GlobalNative gn;
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cond.wait(lock, [this]{ return running == 0; });
+    this->task = nullptr;
+}
+
+void MixWorkers::workerLoop()
+{
+    /* Every call made by this thread is native */
+    GlobalNative gn;
+
+    uint64_t done_number = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        task_cond.wait(lock, [&]{ return quit || (task_number != done_number); });
+        if (quit)
+            break;
+
+        done_number = task_number;
+        const Task* current = task;
+        lock.unlock();
+
+        (*current)();
+
+        lock.lock();
+        if (--running == 0)
+            done_cond.notify_one();
+    }
+}
+
+}
@@ -0,0 +1,78 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_MIXWORKERS_H_INCL
+#define LIBTAS_MIXWORKERS_H_INCL
+
+#include <vector>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+
+namespace libtas {
+
+/* Small pool of threads that help mixing audio sources. The threads are
+ * parked on a condition variable between mixes, so that they are not
+ * created again for every mix.
+ */
+class MixWorkers {
+    public:
+        /* Function run by every thread of the pool and by the caller */
+        typedef std::function<void()> Task;
+
+        /* Start the worker threads.
+         * @param nbThreads      Number of threads that run a task, including
+         *                       the calling thread
+         */
+        MixWorkers(int nbThreads);
+
+        /* Stop the worker threads */
+        ~MixWorkers();
+
+        /* Number of threads that run a task, including the calling thread */
+        int size();
+
+        /* Run a task on every worker thread and on the calling thread, and
+         * return when all of them have finished it */
+        void run(const Task& task);
+
+    private:
+        void workerLoop();
+
+        /* Task being run, and its number so that workers run it only once */
+        const Task* task = nullptr;
+        uint64_t task_number = 0;
+
+        /* Number of workers that did not finish the current task */
+        int running = 0;
+
+        bool quit = false;
+
+        std::mutex mutex;
+        std::condition_variable task_cond;
+        std::condition_variable done_cond;
+
+        std::vector<std::thread> workers;
+};
+
+}
+
+#endif
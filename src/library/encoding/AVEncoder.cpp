@@ -41,25 +41,45 @@ char AVEncoder::ffmpeg_options[4096] = {0};
 
 std::unique_ptr<AVEncoder> avencoder;
 
-
 AVEncoder::AVEncoder() {
-    std::ostringstream commandline;
-    commandline << "ffmpeg -hide_banner -y -f nut -i - ";
-    commandline << ffmpeg_options;
-    commandline << " \"";
-    commandline.write(dumpfile, static_cast<int>(strrchr(dumpfile, '.') - dumpfile));
+    std::ostringstream filename;
+    filename.write(dumpfile, static_cast<int>(strrchr(dumpfile, '.') - dumpfile));
     /* Add segment number to filename if not the first */
     if (segment_number > 0) {
-        commandline << "_" << segment_number;
+        filename << "_" << segment_number;
     }
-    commandline << strrchr(dumpfile, '.');
-    commandline << "\"";
+    backend = shared_config.encode_backend;
+
+    /* Lossless captures are not readable by other programs, so they get
+     * their own extension */
+    if (backend == SharedConfig::ENCODE_BACKEND_CAPTURE)
+        filename << ".ltcap";
+    else
+        filename << strrchr(dumpfile, '.');
+    encodefile = filename.str();
 
-    NATIVECALL(ffmpeg_pipe = popen(commandline.str().c_str(), "w"));
+    /* Many audio sources are mixed in parallel while encoding */
+    audiocontext.startMixWorkers();
 
-    if (! ffmpeg_pipe) {
-        debuglog(LCF_DUMP | LCF_ERROR, "Could not create a pipe to ffmpeg");
-        return;
+#ifndef LIBTAS_HAS_LIBAV
+    if (backend == SharedConfig::ENCODE_BACKEND_LIBAV) {
+        debuglog(LCF_DUMP | LCF_ERROR, "libTAS was built without libavcodec, encoding through ffmpeg instead");
+        backend = SharedConfig::ENCODE_BACKEND_PIPE;
+    }
+#endif
+
+    if (backend == SharedConfig::ENCODE_BACKEND_PIPE) {
+        std::ostringstream commandline;
+        commandline << "ffmpeg -hide_banner -y -f nut -i - ";
+        commandline << ffmpeg_options;
+        commandline << " \"" << encodefile << "\"";
+
+        NATIVECALL(ffmpeg_pipe = popen(commandline.str().c_str(), "w"));
+
+        if (! ffmpeg_pipe) {
+            debuglog(LCF_DUMP | LCF_ERROR, "Could not create a pipe to ffmpeg");
+            return;
+        }
     }
 
     if (ScreenCapture::isInited()) {
@@ -72,17 +92,89 @@ AVEncoder::AVEncoder() {
     sendData(&segment_number, sizeof(int));
 }
 
+template <class Muxer>
+void AVEncoder::startQueue(Muxer* muxer) {
+    /* Writing to the muxer is done by another thread, so that the game does
+     * not wait for the encoder. Only a few frames are buffered. */
+    FrameConverter* converter = frameConverter.get();
+    frameQueue.reset(new FrameQueue(8, [muxer, converter](FrameQueue::FrameType type, const uint8_t* data, int size, int count) {
+        if (type == FrameQueue::VIDEO_REPEAT) {
+            /* The muxer holds the last frame by advancing its timestamps */
+            muxer->skipVideoFrames(count);
+            return;
+        }
+
+        if (type == FrameQueue::AUDIO_FRAME) {
+            for (int c = 0; c < count; c++)
+                muxer->writeAudioFrame(data, size);
+            return;
+        }
+
+        /* Repeated frames are only converted once */
+        if (converter->isActive()) {
+            data = converter->convert(data);
+            size = converter->outSize();
+        }
+        for (int c = 0; c < count; c++)
+            muxer->writeVideoFrame(data, size);
+    }));
+}
+
 void AVEncoder::initMuxer() {
     int width, height;
     ScreenCapture::getDimensions(width, height);
 
     const char* pixfmt = ScreenCapture::getPixelFormat();
 
+    /* Frames may be converted and downscaled before being sent to ffmpeg.
+     * Lossless captures always store the exact pixels. */
+    int video_pixfmt = shared_config.video_pixfmt;
+    int video_downscale = shared_config.video_downscale;
+    if (backend == SharedConfig::ENCODE_BACKEND_CAPTURE) {
+        video_pixfmt = SharedConfig::ENCODE_PIXFMT_NATIVE;
+        video_downscale = 1;
+    }
+
+    int size = ScreenCapture::getPixels(nullptr, false);
+    frameConverter.reset(new FrameConverter(width, height, size, pixfmt, video_pixfmt, video_downscale));
+    width = frameConverter->outWidth();
+    height = frameConverter->outHeight();
+    pixfmt = frameConverter->outPixelFormat();
+    if (frameConverter->isActive())
+        size = frameConverter->outSize();
+
     /* Initialize the muxer with either framerate or video framerate */
-    if (shared_config.variable_framerate)
-        nutMuxer = new NutMuxer(width, height, shared_config.video_framerate, 1, pixfmt, audiocontext.outFrequency, audiocontext.outAlignSize, audiocontext.outNbChannels, ffmpeg_pipe);
-    else
-        nutMuxer = new NutMuxer(width, height, shared_config.framerate_num, shared_config.framerate_den, pixfmt, audiocontext.outFrequency, audiocontext.outAlignSize, audiocontext.outNbChannels, ffmpeg_pipe);
+    int fpsnum = shared_config.framerate_num;
+    int fpsden = shared_config.framerate_den;
+    if (shared_config.variable_framerate) {
+        fpsnum = shared_config.video_framerate;
+        fpsden = 1;
+    }
+
+    if (backend == SharedConfig::ENCODE_BACKEND_CAPTURE) {
+        captureMuxer.reset(new CaptureMuxer(encodefile.c_str(), width, height, size, fpsnum, fpsden, pixfmt, audiocontext.outFrequency, audiocontext.outBitDepth, audiocontext.outNbChannels));
+        if (!captureMuxer->isValid()) {
+            /* Socket is already locked in frame.cpp */
+            sendMessage(MSGB_ENCODE_FAILED);
+        }
+        startQueue(captureMuxer.get());
+        return;
+    }
+
+#ifdef LIBTAS_HAS_LIBAV
+    if (backend == SharedConfig::ENCODE_BACKEND_LIBAV) {
+        libavMuxer.reset(new LibavMuxer(encodefile.c_str(), width, height, fpsnum, fpsden, pixfmt, audiocontext.outFrequency, audiocontext.outBitDepth, audiocontext.outNbChannels, ffmpeg_options));
+        if (!libavMuxer->isValid()) {
+            /* Socket is already locked in frame.cpp */
+            sendMessage(MSGB_ENCODE_FAILED);
+        }
+        startQueue(libavMuxer.get());
+        return;
+    }
+#endif
+
+    nutMuxer = new NutMuxer(width, height, fpsnum, fpsden, pixfmt, audiocontext.outFrequency, audiocontext.outAlignSize, audiocontext.outNbChannels, ffmpeg_pipe);
+    startQueue(nutMuxer);
 }
 
 void AVEncoder::encodeOneFrame(bool draw, TimeHolder frametime) {
@@ -90,21 +182,22 @@ void AVEncoder::encodeOneFrame(bool draw, TimeHolder frametime) {
     /* If the muxer is not initialized, try to initialize it. Otherwise, store
      * that we skipped one frame and we need to encode it later.
      */
-    if (!nutMuxer) {
+    if (!frameQueue) {
         if (ScreenCapture::isInited()) {
             initMuxer();
 
             /* Encode audio samples that we skipped */
-            nutMuxer->writeAudioFrame(startup_audio_bytes.data(), startup_audio_bytes.size());
+            frameQueue->push(FrameQueue::AUDIO_FRAME, startup_audio_bytes.data(), startup_audio_bytes.size());
 
             /* Encode startup frames that we skipped */
 
             /* Just getting the size of an image */
             int size = ScreenCapture::getPixels(nullptr, false);
-            startup_audio_bytes.resize(size, 0); // reusing the audio samples vector
-            for (int i=0; i<startup_video_frames; i++) {
-                nutMuxer->writeVideoFrame(startup_audio_bytes.data(), size);
-            }
+            startup_audio_bytes.assign(size, 0); // reusing the audio samples vector
+            if (startup_video_frames > 0)
+                frameQueue->push(FrameQueue::VIDEO_FRAME, startup_audio_bytes.data(), size, 1);
+            if (startup_video_frames > 1)
+                frameQueue->push(FrameQueue::VIDEO_REPEAT, nullptr, 0, startup_video_frames - 1);
         }
         else {
             startup_video_frames++;
@@ -117,7 +210,7 @@ void AVEncoder::encodeOneFrame(bool draw, TimeHolder frametime) {
     /*** Audio ***/
     debuglog(LCF_DUMP, "Encode an audio frame");
 
-    nutMuxer->writeAudioFrame(audiocontext.outSamples.data(), audiocontext.outBytes);
+    frameQueue->push(FrameQueue::AUDIO_FRAME, audiocontext.outSamples.data(), audiocontext.outBytes);
 
     /*** Video ***/
 
@@ -132,20 +225,108 @@ void AVEncoder::encodeOneFrame(bool draw, TimeHolder frametime) {
         frame_remainder -= frames;
     }
 
-    /* Access to the screen pixels, or last screen pixels if not a draw frame */
+    /* Access to the screen pixels, or last screen pixels if not a draw frame.
+     * The pixels may belong to an earlier frame if the readback is
+     * asynchronous, or may not be available yet. */
+    pending_video_frames.push_back(PendingFrame{frames, draw});
     int size = ScreenCapture::getPixels(&pixels, draw);
+    if (size == 0)
+        return;
+
+    pushVideoFrame(size, pending_video_frames.front());
+    pending_video_frames.pop_front();
+}
+
+void AVEncoder::pushVideoFrame(int size, PendingFrame frame)
+{
+    if (frame.draw)
+        pixels_sent = false;
+
+    if (frame.count <= 0)
+        return;
+
+    /* Identical frames are not sent, the muxer only advances its timestamps.
+     * Pixels of a non-draw frame are the ones of the previous frame, so they
+     * don't need to be compared again. */
+    if (!pixels_sent)
+        pixels_sent = frameQueue->isLastVideoFrame(pixels, size);
+
+    if (pixels_sent) {
+        repeated_frames += frame.count;
+        elided_frames += frame.count;
+        return;
+    }
+
+    if (repeated_frames > 0) {
+        frameQueue->push(FrameQueue::VIDEO_REPEAT, nullptr, 0, repeated_frames);
+        repeated_frames = 0;
+    }
 
-    for (int f=0; f<frames; f++) {
-        debuglog(LCF_DUMP, "Encode a video frame");
-        nutMuxer->writeVideoFrame(pixels, size);
+    debuglog(LCF_DUMP, "Encode ", frame.count, " video frame(s)");
+    frameQueue->push(FrameQueue::VIDEO_FRAME, pixels, size, 1);
+    pixels_sent = true;
+
+    /* Additional frames of variable framerate are repeats */
+    repeated_frames += frame.count - 1;
+    elided_frames += frame.count - 1;
+}
+
+void AVEncoder::flushPendingFrames(bool collect)
+{
+    if (!frameQueue)
+        return;
+
+    int size;
+    while (collect && !pending_video_frames.empty() && ((size = ScreenCapture::flushPixels(&pixels)) > 0)) {
+        pushVideoFrame(size, pending_video_frames.front());
+        pending_video_frames.pop_front();
+    }
+
+    /* Frames whose readback is lost show the last frame */
+    int lost_frames = 0;
+    for (const PendingFrame& frame : pending_video_frames)
+        lost_frames += frame.count;
+    pending_video_frames.clear();
+
+    if ((lost_frames > 0) && frameQueue->hasLastVideoFrame()) {
+        debuglog(LCF_DUMP | LCF_WARNING, "Repeating the last video frame for ", lost_frames, " frame(s) whose readback was lost");
+        repeated_frames += lost_frames;
+        elided_frames += lost_frames;
     }
 }
 
 AVEncoder::~AVEncoder() {
+    audiocontext.stopMixWorkers();
+
+    if (frameQueue) {
+        /* Encode the frames whose readback is still pending */
+        flushPendingFrames(true);
+
+        /* Send the last repeated frame for real, so that the video does
+         * not end before the audio */
+        if (repeated_frames > 0) {
+            if (repeated_frames > 1)
+                frameQueue->push(FrameQueue::VIDEO_REPEAT, nullptr, 0, repeated_frames - 1);
+            frameQueue->pushLastVideoFrame();
+            elided_frames--;
+        }
+
+        debuglog(LCF_DUMP, "Encoder did not send ", elided_frames, " identical video frame(s)");
+
+        /* Write all queued frames before finishing the stream */
+        frameQueue.reset(nullptr);
+    }
+
     if (nutMuxer) {
         nutMuxer->finish();
     }
 
+#ifdef LIBTAS_HAS_LIBAV
+    libavMuxer.reset(nullptr);
+#endif
+
+    captureMuxer.reset(nullptr);
+
     if (ffmpeg_pipe) {
         int ret;
         NATIVECALL(ret = pclose(ffmpeg_pipe));
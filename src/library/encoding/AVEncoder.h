@@ -21,9 +21,15 @@
 #define LIBTAS_AVDUMPING_H_INCL
 
 #include "NutMuxer.h"
+#include "FrameQueue.h"
+#include "FrameConverter.h"
+#include "LibavMuxer.h"
+#include "CaptureMuxer.h"
 #include "../TimeHolder.h"
 #include <vector>
+#include <deque>
 #include <memory> // std::unique_ptr
+#include <string>
 
 namespace libtas {
 class AVEncoder {
@@ -45,6 +51,14 @@ class AVEncoder {
          */
         void encodeOneFrame(bool draw, TimeHolder frametime);
 
+        /* Encode the frames whose readback is still pending, before the
+         * screen capture is closed. If the readbacks cannot be collected,
+         * the last frame is repeated instead, so that the video keeps its
+         * length.
+         * @param collect        Can the readbacks be collected?
+         */
+        void flushPendingFrames(bool collect);
+
         /* Close all allocated objects and close the pipe at the end of an av dump
          */
         ~AVEncoder();
@@ -60,9 +74,31 @@ class AVEncoder {
 
         static int segment_number;
     private:
+        /* Start the writer thread on a muxer */
+        template <class Muxer>
+        void startQueue(Muxer* muxer);
+
+        /* Filename of this segment */
+        std::string encodefile;
+
+        /* How frames are encoded, from SharedConfig::EncodeBackend */
+        int backend;
+
         FILE *ffmpeg_pipe = nullptr;
         NutMuxer* nutMuxer = nullptr;
 
+#ifdef LIBTAS_HAS_LIBAV
+        std::unique_ptr<LibavMuxer> libavMuxer;
+#endif
+
+        std::unique_ptr<CaptureMuxer> captureMuxer;
+
+        /* Conversion of the frames before muxing, done by the writer thread */
+        std::unique_ptr<FrameConverter> frameConverter;
+
+        /* Queue of frames written to the muxer by a separate thread */
+        std::unique_ptr<FrameQueue> frameQueue;
+
         uint8_t* pixels = nullptr;
 
         int startup_video_frames = 0;
@@ -70,6 +106,26 @@ class AVEncoder {
 
         /* remainder of the number of video frames to send */
         double frame_remainder = 0;
+
+        /* Captured frame whose pixels are not available yet */
+        struct PendingFrame {
+            int count; // Number of video frames to send
+            bool draw; // Was it a draw frame?
+        };
+        std::deque<PendingFrame> pending_video_frames;
+
+        /* Send the pixels of a captured frame, or only repeat the last sent
+         * frame if the pixels did not change */
+        void pushVideoFrame(int size, PendingFrame frame);
+
+        /* Are the current pixels identical to the last frame sent? */
+        bool pixels_sent = false;
+
+        /* Number of repeated frames that were not sent yet */
+        int repeated_frames = 0;
+
+        /* Total number of frames that were not sent because identical */
+        uint64_t elided_frames = 0;
 };
 
 extern std::unique_ptr<AVEncoder> avencoder;
@@ -0,0 +1,307 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CaptureMuxer.h"
+
+#include "../logging.h"
+#include "../GlobalState.h"
+#include "../../external/lz4.h"
+
+#include <cstring> // memcpy
+#include <algorithm> // std::min
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace libtas {
+
+/* Minimum size of the mapped window of the file */
+static const uint64_t WINDOW_SIZE = 64 * 1024 * 1024;
+
+CaptureMuxer::CaptureMuxer(const char* filename, int width, int height, int size, int fpsnum, int fpsden, const char* pixfmt, int samplerate, int bitdepth, int channels)
+{
+    GlobalNative gn;
+
+    memset(&header, 0, sizeof(FileHeader));
+    memcpy(header.magic, "LTASCAP", 8);
+    header.version = 1;
+    header.width = width;
+    header.height = height;
+    memcpy(header.pixfmt, pixfmt, 4);
+    header.frame_size = size;
+    header.fpsnum = fpsnum;
+    header.fpsden = fpsden;
+    header.samplerate = samplerate;
+    header.bitdepth = bitdepth;
+    header.channels = channels;
+    sample_size = channels * bitdepth / 8;
+
+    /* Predict each byte from the byte of the line above. For planar YUV
+     * frames, this is the stride of the luma plane. */
+    if ((memcmp(pixfmt, "I420", 4) == 0) || (memcmp(pixfmt, "NV12", 4) == 0))
+        header.stride = width;
+    else
+        header.stride = size / height;
+
+    /* Leave some cores to the game and the encoder writer thread */
+    int bands = std::thread::hardware_concurrency() / 2;
+    header.bands = std::max(1, std::min(bands, 8));
+
+    fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        debuglog(LCF_DUMP | LCF_ERROR, "Could not create capture file ", filename);
+        return;
+    }
+    valid = true;
+
+    /* The header is completed when the capture is finished */
+    uint8_t* dst = reserve(sizeof(FileHeader));
+    if (!dst)
+        return;
+    memcpy(dst, &header, sizeof(FileHeader));
+    write_offset += sizeof(FileHeader);
+
+    int max_band = size / header.bands + 1;
+    filtered.resize(header.bands, std::vector<uint8_t>(max_band));
+    compressed.resize(header.bands, std::vector<uint8_t>(LZ4_compressBound(max_band)));
+    compressed_sizes.resize(header.bands);
+
+    for (unsigned int b = 1; b < header.bands; b++) {
+        NATIVECALL(workers.emplace_back(&CaptureMuxer::workerLoop, this, b));
+    }
+}
+
+CaptureMuxer::~CaptureMuxer()
+{
+    GlobalNative gn;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    work_cond.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+
+    if (fd < 0)
+        return;
+
+    if (valid) {
+        /* Write the index at the end of the file */
+        uint64_t index_size = index.size() * sizeof(IndexEntry);
+        uint8_t* dst = reserve(index_size);
+        if (dst) {
+            memcpy(dst, index.data(), index_size);
+            header.index_offset = write_offset;
+            header.index_count = index.size();
+            write_offset += index_size;
+        }
+    }
+
+    if (window)
+        munmap(window, window_size);
+
+    /* Complete the header, which is no longer in the mapped window */
+    header.video_frames = video_pts;
+    if (pwrite(fd, &header, sizeof(FileHeader), 0) != sizeof(FileHeader))
+        debuglog(LCF_DUMP | LCF_ERROR, "Could not write the capture file header");
+
+    /* Remove the unused preallocated space */
+    if (ftruncate(fd, write_offset) < 0)
+        debuglog(LCF_DUMP | LCF_ERROR, "Could not truncate the capture file");
+
+    close(fd);
+
+    debuglog(LCF_DUMP, "Captured ", video_pts, " video frames in ", write_offset, " bytes");
+}
+
+bool CaptureMuxer::isValid()
+{
+    return valid;
+}
+
+uint8_t* CaptureMuxer::reserve(uint64_t size)
+{
+    if (!valid)
+        return nullptr;
+
+    if ((write_offset + size) <= (window_offset + window_size))
+        return window + (write_offset - window_offset);
+
+    if (window)
+        munmap(window, window_size);
+    window = nullptr;
+
+    /* Map a new window that starts at the page of the current offset */
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    window_offset = write_offset - (write_offset % page_size);
+    window_size = WINDOW_SIZE;
+    while ((write_offset - window_offset + size) > window_size)
+        window_size *= 2;
+
+    /* Allocate the disk space now, so that writing into the mapping does
+     * not fail when the disk is full */
+    if ((window_offset + window_size) > file_size) {
+        int ret = posix_fallocate(fd, file_size, window_offset + window_size - file_size);
+        if (ret != 0) {
+            debuglog(LCF_DUMP | LCF_ERROR, "Could not grow the capture file: ", strerror(ret));
+            valid = false;
+            window_size = 0;
+            return nullptr;
+        }
+        file_size = window_offset + window_size;
+    }
+
+    void* addr = mmap(nullptr, window_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, window_offset);
+    if (addr == MAP_FAILED) {
+        debuglog(LCF_DUMP | LCF_ERROR, "Could not map the capture file");
+        valid = false;
+        window_size = 0;
+        return nullptr;
+    }
+    window = static_cast<uint8_t*>(addr);
+
+    return window + (write_offset - window_offset);
+}
+
+void CaptureMuxer::writeRecord(RecordType type, uint64_t pts, const uint8_t* data, int size)
+{
+    uint8_t* dst = reserve(sizeof(RecordHeader) + size);
+    if (!dst)
+        return;
+
+    RecordHeader record = {static_cast<uint32_t>(type), static_cast<uint32_t>(size), pts};
+    memcpy(dst, &record, sizeof(RecordHeader));
+    memcpy(dst + sizeof(RecordHeader), data, size);
+
+    index.push_back(IndexEntry{record.type, record.size, pts, write_offset});
+    write_offset += sizeof(RecordHeader) + size;
+}
+
+void CaptureMuxer::compressBand(int band)
+{
+    int start = static_cast<int64_t>(frame_len) * band / header.bands;
+    int end = static_cast<int64_t>(frame_len) * (band + 1) / header.bands;
+    int n = end - start;
+    int stride = header.stride;
+
+    /* Up prediction, restarted at each band so that bands are decoded
+     * independently */
+    const uint8_t* in = frame + start;
+    uint8_t* out = filtered[band].data();
+    int s = std::min(stride, n);
+    memcpy(out, in, s);
+    for (int i = s; i < n; i++)
+        out[i] = in[i] - in[i - stride];
+
+    compressed_sizes[band] = LZ4_compress_default(reinterpret_cast<const char*>(out),
+        reinterpret_cast<char*>(compressed[band].data()), n, compressed[band].size());
+}
+
+void CaptureMuxer::workerLoop(int band)
+{
+    /* Every call made by this thread is native */
+    GlobalNative gn;
+
+    uint64_t done_generation = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        work_cond.wait(lock, [this, done_generation]{ return quit || (generation != done_generation); });
+        if (quit)
+            break;
+        done_generation = generation;
+
+        lock.unlock();
+        compressBand(band);
+        lock.lock();
+
+        if (--remaining_bands == 0)
+            done_cond.notify_one();
+    }
+}
+
+void CaptureMuxer::writeVideoFrame(const uint8_t* video, int len)
+{
+    GlobalNative gn;
+
+    if (!valid)
+        return;
+
+    if (len != static_cast<int>(header.frame_size)) {
+        debuglog(LCF_DUMP | LCF_ERROR, "Captured frame has size ", len, " instead of ", header.frame_size);
+        return;
+    }
+
+    /* Compress all bands in parallel */
+    frame = video;
+    frame_len = len;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        remaining_bands = header.bands - 1;
+        generation++;
+    }
+    work_cond.notify_all();
+
+    compressBand(0);
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cond.wait(lock, [this]{ return remaining_bands == 0; });
+    }
+
+    uint32_t size = header.bands * sizeof(uint32_t);
+    for (uint32_t band_size : compressed_sizes)
+        size += band_size;
+
+    uint8_t* dst = reserve(sizeof(RecordHeader) + size);
+    if (!dst)
+        return;
+
+    RecordHeader record = {VIDEO_RECORD, size, video_pts};
+    memcpy(dst, &record, sizeof(RecordHeader));
+    dst += sizeof(RecordHeader);
+    memcpy(dst, compressed_sizes.data(), header.bands * sizeof(uint32_t));
+    dst += header.bands * sizeof(uint32_t);
+    for (unsigned int b = 0; b < header.bands; b++) {
+        memcpy(dst, compressed[b].data(), compressed_sizes[b]);
+        dst += compressed_sizes[b];
+    }
+
+    index.push_back(IndexEntry{VIDEO_RECORD, size, video_pts, write_offset});
+    write_offset += sizeof(RecordHeader) + size;
+    video_pts++;
+}
+
+void CaptureMuxer::skipVideoFrames(int count)
+{
+    video_pts += count;
+}
+
+void CaptureMuxer::writeAudioFrame(const uint8_t* samples, int len)
+{
+    GlobalNative gn;
+
+    if (!valid)
+        return;
+
+    writeRecord(AUDIO_RECORD, audio_pts, samples, len);
+    audio_pts += len / sample_size;
+}
+
+}
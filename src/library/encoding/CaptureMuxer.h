@@ -0,0 +1,168 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_CAPTUREMUXER_H_INCL
+#define LIBTAS_CAPTUREMUXER_H_INCL
+
+#include <vector>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace libtas {
+
+/* Write audio and video frames losslessly into a libTAS capture file, so that
+ * they can be transcoded later without running an encoder during the dump.
+ * The file is written through a memory-mapped window that is moved forward
+ * as the file grows. Each video frame is split into bands that are filtered
+ * and compressed with LZ4 in parallel by worker threads.
+ *
+ * All integers are little-endian. The file is made of:
+ * - a FileHeader,
+ * - a sequence of records, each one starting with a RecordHeader:
+ *   - video records contain the compressed size of each band as uint32_t,
+ *     followed by the compressed bands. Band i contains bytes
+ *     [i*size/bands, (i+1)*size/bands) of the frame, and each byte was
+ *     replaced by its difference with the byte `stride` bytes before, when
+ *     it is inside the band,
+ *   - audio records contain raw samples,
+ * - an index of all records, made of IndexEntry.
+ * Video pts is in frames and audio pts is in samples. A video frame lasts
+ * until the pts of the next video frame, so that repeated frames are not
+ * stored.
+ */
+class CaptureMuxer {
+    public:
+        enum RecordType {
+            VIDEO_RECORD = 0,
+            AUDIO_RECORD = 1,
+        };
+
+        struct __attribute__((packed)) FileHeader {
+            char magic[8]; // "LTASCAP\0"
+            uint32_t version;
+            uint32_t width;
+            uint32_t height;
+            char pixfmt[4]; // fourcc of video frames
+            uint32_t frame_size; // uncompressed size of a video frame
+            uint32_t stride; // distance of the byte used to predict each byte
+            uint32_t bands; // number of compressed bands of a video frame
+            uint32_t fpsnum;
+            uint32_t fpsden;
+            uint32_t samplerate;
+            uint32_t bitdepth;
+            uint32_t channels;
+            uint64_t video_frames; // total number of frames, including repeated ones
+            uint64_t index_offset; // 0 if the capture was not finished
+            uint64_t index_count;
+        };
+
+        struct __attribute__((packed)) RecordHeader {
+            uint32_t type;
+            uint32_t size; // size of the data following this header
+            uint64_t pts;
+        };
+
+        struct __attribute__((packed)) IndexEntry {
+            uint32_t type;
+            uint32_t size;
+            uint64_t pts;
+            uint64_t offset; // offset of the RecordHeader
+        };
+
+        /* @param filename       Path of the capture file
+         * @param width          Width of video frames
+         * @param height         Height of video frames
+         * @param size           Size of a video frame
+         * @param fpsnum         Framerate numerator
+         * @param fpsden         Framerate denominator
+         * @param pixfmt         Fourcc of the video frames
+         * @param samplerate     Audio sample rate
+         * @param bitdepth       Bit depth of audio samples
+         * @param channels       Number of audio channels
+         */
+        CaptureMuxer(const char* filename, int width, int height, int size, int fpsnum, int fpsden, const char* pixfmt, int samplerate, int bitdepth, int channels);
+
+        /* Write the index and truncate the file to its final size */
+        ~CaptureMuxer();
+
+        /* Was the file successfully created? */
+        bool isValid();
+
+        void writeVideoFrame(const uint8_t* video, int len);
+
+        /* Advance the video pts without storing frames, so that the last
+         * frame is held */
+        void skipVideoFrames(int count);
+
+        void writeAudioFrame(const uint8_t* samples, int len);
+
+    private:
+        bool valid = false;
+
+        FileHeader header;
+        int sample_size;
+        uint64_t video_pts = 0;
+        uint64_t audio_pts = 0;
+
+        std::vector<IndexEntry> index;
+
+        /* Output file and its current mapped window */
+        int fd = -1;
+        uint64_t file_size = 0;
+        uint64_t write_offset = 0;
+        uint8_t* window = nullptr;
+        uint64_t window_offset = 0;
+        uint64_t window_size = 0;
+
+        /* Get a pointer to write `size` bytes at the current offset,
+         * growing the file and moving the window if needed */
+        uint8_t* reserve(uint64_t size);
+
+        /* Write a record into the file */
+        void writeRecord(RecordType type, uint64_t pts, const uint8_t* data, int size);
+
+        /* Filtered and compressed data of each band */
+        std::vector<std::vector<uint8_t>> filtered;
+        std::vector<std::vector<uint8_t>> compressed;
+        std::vector<uint32_t> compressed_sizes;
+
+        /* Frame being compressed */
+        const uint8_t* frame = nullptr;
+        int frame_len = 0;
+
+        void compressBand(int band);
+
+        /* Worker threads compress all the bands except the first one,
+         * which is compressed by the calling thread */
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable work_cond;
+        std::condition_variable done_cond;
+        uint64_t generation = 0;
+        int remaining_bands = 0;
+        bool quit = false;
+
+        void workerLoop(int band);
+};
+
+}
+
+#endif
@@ -0,0 +1,221 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FrameConverter.h"
+
+#include "../logging.h"
+#include "../../shared/SharedConfig.h"
+
+#include <cstring> // memcmp
+#include <algorithm> // std::fill
+
+namespace libtas {
+
+FrameConverter::FrameConverter(int w, int h, int size, const char* pf, int f, int d) :
+    width(w), height(h), pixfmt(pf), format(f), downscale(d)
+{
+    if (downscale < 1)
+        downscale = 1;
+
+    /* Get the position of each color inside a pixel */
+    if (memcmp(pixfmt, "24BG", 4) == 0) {
+        bpp = 3; roff = 2; goff = 1; boff = 0;
+    }
+    else if (memcmp(pixfmt, "RAW ", 4) == 0) {
+        bpp = 3; roff = 0; goff = 1; boff = 2;
+    }
+    else {
+        bpp = 4; roff = goff = boff = -1;
+        for (int i = 0; i < 4; i++) {
+            if (pixfmt[i] == 'R') roff = i;
+            if (pixfmt[i] == 'G') goff = i;
+            if (pixfmt[i] == 'B') boff = i;
+        }
+    }
+
+    if ((roff < 0) || (goff < 0) || (boff < 0) || (size != width * height * bpp)) {
+        debuglog(LCF_DUMP | LCF_ERROR, "Pixel format cannot be converted, frames are sent unmodified");
+        format = SharedConfig::ENCODE_PIXFMT_NATIVE;
+        downscale = 1;
+    }
+
+    out_width = width / downscale;
+    out_height = height / downscale;
+
+    /* Chroma subsampling needs even dimensions */
+    if (format != SharedConfig::ENCODE_PIXFMT_NATIVE) {
+        out_width &= ~1;
+        out_height &= ~1;
+    }
+
+    if (downscale > 1)
+        scaled.resize((width / downscale) * (height / downscale) * bpp);
+    if (format != SharedConfig::ENCODE_PIXFMT_NATIVE)
+        converted.resize(outSize());
+
+    if (isActive())
+        debuglog(LCF_DUMP, "Converting frames to ", outPixelFormat(), " with dimensions ", out_width, "x", out_height);
+}
+
+bool FrameConverter::isActive()
+{
+    return (format != SharedConfig::ENCODE_PIXFMT_NATIVE) || (downscale > 1);
+}
+
+int FrameConverter::outWidth()
+{
+    return out_width;
+}
+
+int FrameConverter::outHeight()
+{
+    return out_height;
+}
+
+const char* FrameConverter::outPixelFormat()
+{
+    switch (format) {
+        case SharedConfig::ENCODE_PIXFMT_YUV420P:
+            return "I420";
+        case SharedConfig::ENCODE_PIXFMT_NV12:
+            return "NV12";
+        default:
+            return pixfmt;
+    }
+}
+
+int FrameConverter::outSize()
+{
+    if (format == SharedConfig::ENCODE_PIXFMT_NATIVE)
+        return out_width * out_height * bpp;
+    return out_width * out_height * 3 / 2;
+}
+
+/* Average each block of k*k pixels. Each byte of a pixel is processed
+ * independently, so that the pixel format does not matter. */
+static void boxDownscale(const uint8_t* src, int width, int bpp, int k, int out_width, int out_height, uint8_t* dst)
+{
+    int row_bytes = out_width * bpp;
+    unsigned int area = k * k;
+    std::vector<unsigned int> sums(row_bytes);
+
+    for (int y = 0; y < out_height; y++) {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int dy = 0; dy < k; dy++) {
+            const uint8_t* line = src + (y * k + dy) * width * bpp;
+            for (int x = 0; x < out_width; x++) {
+                for (int dx = 0; dx < k; dx++) {
+                    for (int c = 0; c < bpp; c++) {
+                        sums[x * bpp + c] += line[(x * k + dx) * bpp + c];
+                    }
+                }
+            }
+        }
+        uint8_t* out = dst + y * row_bytes;
+        for (int i = 0; i < row_bytes; i++) {
+            out[i] = (sums[i] + area / 2) / area;
+        }
+    }
+}
+
+/* Convert packed RGB into YUV 4:2:0 with BT.601 limited range coefficients.
+ * Chroma is computed from the average of each 2x2 block. Color positions are
+ * template parameters so that the loops can be vectorized. Chroma values are
+ * written every `chroma_step` bytes, which allows both planar and NV12 output.
+ */
+template <int BPP, int R, int G, int B>
+static inline __attribute__((always_inline)) void rgbToYuv420(const uint8_t* src, int stride, int width, int height, uint8_t* y_plane, uint8_t* u_plane, uint8_t* v_plane, int chroma_step)
+{
+    for (int y = 0; y < height; y += 2) {
+        const uint8_t* row0 = src + y * stride;
+        const uint8_t* row1 = row0 + stride;
+        uint8_t* y0 = y_plane + y * width;
+        uint8_t* y1 = y0 + width;
+
+        for (int x = 0; x < width; x++) {
+            const uint8_t* p0 = row0 + x * BPP;
+            const uint8_t* p1 = row1 + x * BPP;
+            y0[x] = ((66 * p0[R] + 129 * p0[G] + 25 * p0[B] + 128) >> 8) + 16;
+            y1[x] = ((66 * p1[R] + 129 * p1[G] + 25 * p1[B] + 128) >> 8) + 16;
+        }
+
+        uint8_t* u = u_plane + (y / 2) * (width / 2) * chroma_step;
+        uint8_t* v = v_plane + (y / 2) * (width / 2) * chroma_step;
+        for (int x = 0; x < width / 2; x++) {
+            const uint8_t* p0 = row0 + 2 * x * BPP;
+            const uint8_t* p1 = row1 + 2 * x * BPP;
+            int r = p0[R] + p0[BPP + R] + p1[R] + p1[BPP + R];
+            int g = p0[G] + p0[BPP + G] + p1[G] + p1[BPP + G];
+            int b = p0[B] + p0[BPP + B] + p1[B] + p1[BPP + B];
+            u[x * chroma_step] = ((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128;
+            v[x * chroma_step] = ((112 * r - 94 * g - 18 * b + 512) >> 10) + 128;
+        }
+    }
+}
+
+__attribute__((target_clones("avx2", "default")))
+static void convertYuv420(const uint8_t* src, int stride, int bpp, int roff, int boff, int width, int height, uint8_t* y_plane, uint8_t* u_plane, uint8_t* v_plane, int chroma_step)
+{
+    /* Green is always in the middle of red and blue */
+    if (bpp == 3) {
+        if (roff == 0)
+            rgbToYuv420<3, 0, 1, 2>(src, stride, width, height, y_plane, u_plane, v_plane, chroma_step);
+        else
+            rgbToYuv420<3, 2, 1, 0>(src, stride, width, height, y_plane, u_plane, v_plane, chroma_step);
+    }
+    else {
+        if ((roff == 0) && (boff == 2))
+            rgbToYuv420<4, 0, 1, 2>(src, stride, width, height, y_plane, u_plane, v_plane, chroma_step);
+        else if ((roff == 2) && (boff == 0))
+            rgbToYuv420<4, 2, 1, 0>(src, stride, width, height, y_plane, u_plane, v_plane, chroma_step);
+        else if ((roff == 1) && (boff == 3))
+            rgbToYuv420<4, 1, 2, 3>(src, stride, width, height, y_plane, u_plane, v_plane, chroma_step);
+        else
+            rgbToYuv420<4, 3, 2, 1>(src, stride, width, height, y_plane, u_plane, v_plane, chroma_step);
+    }
+}
+
+const uint8_t* FrameConverter::convert(const uint8_t* pixels)
+{
+    const uint8_t* src = pixels;
+    int stride = width * bpp;
+
+    if (downscale > 1) {
+        boxDownscale(pixels, width, bpp, downscale, width / downscale, height / downscale, scaled.data());
+        src = scaled.data();
+        stride = (width / downscale) * bpp;
+    }
+
+    if (format == SharedConfig::ENCODE_PIXFMT_NATIVE)
+        return src;
+
+    uint8_t* y_plane = converted.data();
+    uint8_t* u_plane = y_plane + out_width * out_height;
+    if (format == SharedConfig::ENCODE_PIXFMT_NV12) {
+        convertYuv420(src, stride, bpp, roff, boff, out_width, out_height, y_plane, u_plane, u_plane + 1, 2);
+    }
+    else {
+        uint8_t* v_plane = u_plane + (out_width / 2) * (out_height / 2);
+        convertYuv420(src, stride, bpp, roff, boff, out_width, out_height, y_plane, u_plane, v_plane, 1);
+    }
+
+    return converted.data();
+}
+
+}
@@ -0,0 +1,74 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_FRAMECONVERTER_H_INCL
+#define LIBTAS_FRAMECONVERTER_H_INCL
+
+#include <vector>
+#include <cstdint>
+
+namespace libtas {
+
+/* Convert screen frames into the pixel format and dimensions sent to the
+ * encoder. Frames can be downscaled by an integer factor using a box filter,
+ * and converted from packed RGB to YUV 4:2:0 (planar or NV12) using BT.601
+ * limited range, which is what ffmpeg would use to convert them.
+ */
+class FrameConverter {
+    public:
+        /* @param width          Width of the screen frames
+         * @param height         Height of the screen frames
+         * @param size           Size of the screen frames
+         * @param pixfmt         Pixel format of the screen frames, as returned by ScreenCapture
+         * @param format         Output pixel format, from SharedConfig::EncodePixelFormat
+         * @param downscale      Integer downscale factor
+         */
+        FrameConverter(int width, int height, int size, const char* pixfmt, int format, int downscale);
+
+        /* Does this object modify the frames? */
+        bool isActive();
+
+        /* Dimensions, pixel format and size of the converted frames */
+        int outWidth();
+        int outHeight();
+        const char* outPixelFormat();
+        int outSize();
+
+        /* Convert a frame. The returned array is valid until the next call. */
+        const uint8_t* convert(const uint8_t* pixels);
+
+    private:
+        int width, height;
+        const char* pixfmt;
+        int format;
+        int downscale;
+
+        /* Bytes per pixel and byte position of each color in a source pixel */
+        int bpp;
+        int roff, goff, boff;
+
+        int out_width, out_height;
+
+        std::vector<uint8_t> scaled;
+        std::vector<uint8_t> converted;
+};
+
+}
+
+#endif
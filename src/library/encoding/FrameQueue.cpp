@@ -0,0 +1,167 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FrameQueue.h"
+
+#include "../logging.h"
+#include "../GlobalState.h"
+#include "../TimeHolder.h"
+
+#include <cstring> // memcpy
+#include <time.h>
+
+namespace libtas {
+
+FrameQueue::FrameQueue(int c, WriteFunction w) : capacity(c), write(w)
+{
+    /* The writer thread is not a game thread, so it must not be registered
+     * by our pthread_create hook. */
+    NATIVECALL(writer = std::thread(&FrameQueue::writerLoop, this));
+}
+
+FrameQueue::~FrameQueue()
+{
+    GlobalNative gn;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    frame_cond.notify_all();
+    writer.join();
+
+    debuglog(LCF_DUMP, "Encoder queue pushed ", pushed_frames, " frames, waited for ",
+        blocked_frames, " of them during ", blocked_time / 1000000, " ms, max depth was ", max_depth);
+}
+
+void FrameQueue::waitForSpace(std::unique_lock<std::mutex>& lock)
+{
+    if (static_cast<int>(queue.size()) < capacity)
+        return;
+
+    TimeHolder start_time, end_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    space_cond.wait(lock, [this]{ return static_cast<int>(queue.size()) < capacity; });
+
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    TimeHolder delta_time = end_time - start_time;
+    blocked_frames++;
+    blocked_time += delta_time.tv_sec * 1000000000ULL + delta_time.tv_nsec;
+}
+
+void FrameQueue::enqueue(Frame frame)
+{
+    if (frame.type == VIDEO_FRAME) {
+        /* The previous video frame goes back to the pool if it was written,
+         * otherwise the writer thread puts it there */
+        if (last_video && (last_video != frame.buffer) && (last_video.use_count() == 1))
+            pool.push_back(std::move(last_video));
+        last_video = frame.buffer;
+    }
+
+    queue.push_back(std::move(frame));
+    pushed_frames++;
+    if (static_cast<int>(queue.size()) > max_depth)
+        max_depth = queue.size();
+}
+
+void FrameQueue::push(FrameType type, const uint8_t* data, int size, int count)
+{
+    GlobalNative gn;
+
+    Buffer buffer;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        waitForSpace(lock);
+
+        if (!pool.empty()) {
+            buffer = std::move(pool.back());
+            pool.pop_back();
+        }
+    }
+
+    /* The buffer is ours, so the copy is done without holding the lock */
+    if (!buffer)
+        buffer = std::make_shared<std::vector<uint8_t>>();
+    buffer->resize(size);
+    if (size > 0)
+        memcpy(buffer->data(), data, size);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        enqueue(Frame{type, size, count, std::move(buffer)});
+    }
+    frame_cond.notify_one();
+}
+
+bool FrameQueue::isLastVideoFrame(const uint8_t* data, int size)
+{
+    return last_video && (static_cast<int>(last_video->size()) == size) &&
+        (memcmp(last_video->data(), data, size) == 0);
+}
+
+bool FrameQueue::hasLastVideoFrame()
+{
+    return !!last_video;
+}
+
+void FrameQueue::pushLastVideoFrame()
+{
+    GlobalNative gn;
+
+    if (!last_video)
+        return;
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        waitForSpace(lock);
+        enqueue(Frame{VIDEO_FRAME, static_cast<int>(last_video->size()), 1, last_video});
+    }
+    frame_cond.notify_one();
+}
+
+void FrameQueue::writerLoop()
+{
+    /* Every call made by this thread is native */
+    GlobalNative gn;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        frame_cond.wait(lock, [this]{ return quit || !queue.empty(); });
+
+        /* Remaining frames are written before quitting */
+        if (queue.empty())
+            break;
+
+        Frame frame = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+
+        write(frame.type, frame.buffer->data(), frame.size, frame.count);
+
+        lock.lock();
+        /* The last video frame is kept for comparison */
+        if (frame.buffer != last_video)
+            pool.push_back(std::move(frame.buffer));
+        space_cond.notify_all();
+    }
+}
+
+}
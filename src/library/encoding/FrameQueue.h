@@ -0,0 +1,128 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_FRAMEQUEUE_H_INCL
+#define LIBTAS_FRAMEQUEUE_H_INCL
+
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <memory> // std::shared_ptr
+
+namespace libtas {
+
+/* Bounded queue of audio and video frames, drained by a writer thread. Frames
+ * are copied into pooled buffers, so that the game thread only pays for one
+ * copy while the writer thread pushes the data into the encoder. When the
+ * queue is full, the game thread waits for the writer thread.
+ */
+class FrameQueue {
+    public:
+        enum FrameType {
+            VIDEO_FRAME,
+            AUDIO_FRAME,
+            VIDEO_REPEAT, // Repeat the last video frame, without any data
+        };
+
+        /* Function called by the writer thread to write a frame `count` times */
+        typedef std::function<void(FrameType type, const uint8_t* data, int size, int count)> WriteFunction;
+
+        /* Start the writer thread.
+         * @param capacity       Maximum number of frames in the queue
+         * @param write          Function that writes one frame
+         */
+        FrameQueue(int capacity, WriteFunction write);
+
+        /* Write all remaining frames and stop the writer thread */
+        ~FrameQueue();
+
+        /* Copy a frame into the queue.
+         * @param type           Type of the frame
+         * @param data           Frame data
+         * @param size           Size of the frame data
+         * @param count          Number of times the frame is written
+         */
+        void push(FrameType type, const uint8_t* data, int size, int count = 1);
+
+        /* Check if a frame is identical to the last video frame pushed. The
+         * buffer of that frame is kept out of the pool until another video
+         * frame is pushed, so the comparison needs no extra copy. */
+        bool isLastVideoFrame(const uint8_t* data, int size);
+
+        /* Was a video frame pushed? */
+        bool hasLastVideoFrame();
+
+        /* Push the last video frame again, sharing its buffer */
+        void pushLastVideoFrame();
+
+        /* Back-pressure metrics: number of pushed frames, number of pushes
+         * that had to wait for the writer thread, total time waited in
+         * nanoseconds, and maximum number of frames in the queue.
+         */
+        uint64_t pushed_frames = 0;
+        uint64_t blocked_frames = 0;
+        uint64_t blocked_time = 0;
+        int max_depth = 0;
+
+    private:
+        typedef std::shared_ptr<std::vector<uint8_t>> Buffer;
+
+        struct Frame {
+            FrameType type;
+            int size;
+            int count;
+            Buffer buffer;
+        };
+
+        void writerLoop();
+
+        /* Wait for the writer thread if the queue is full */
+        void waitForSpace(std::unique_lock<std::mutex>& lock);
+
+        /* Add a frame to the queue, with the lock held */
+        void enqueue(Frame frame);
+
+        int capacity;
+        WriteFunction write;
+
+        std::deque<Frame> queue;
+
+        /* Buffers that can be reused */
+        std::vector<Buffer> pool;
+
+        /* Buffer of the last video frame pushed. It is only modified by the
+         * pushing thread, and the writer thread only reads it. */
+        Buffer last_video;
+
+        bool quit = false;
+
+        std::mutex mutex;
+        std::condition_variable frame_cond;
+        std::condition_variable space_cond;
+
+        std::thread writer;
+};
+
+}
+
+#endif
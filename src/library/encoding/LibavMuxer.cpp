@@ -0,0 +1,518 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "LibavMuxer.h"
+#ifdef LIBTAS_HAS_LIBAV
+
+#include "../logging.h"
+#include "../hook.h"
+#include "../GlobalState.h"
+
+#include <cstring> // memcmp
+#include <cstdlib> // strtoll
+#include <string>
+#include <sstream>
+
+/* Channel layouts are described by AVChannelLayout since FFmpeg 5.1, and the
+ * channel layout masks were removed in FFmpeg 7.0 */
+#define LIBAV_HAS_CH_LAYOUT (LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 28, 100))
+
+namespace libtas {
+
+/* Link dynamically to avcodec/avformat/swscale functions, like swresample
+ * functions in AudioSource. We use the major version that we were built
+ * against, because we access fields of their structs.
+ */
+DEFINE_ORIG_POINTER(avformat_alloc_output_context2);
+DEFINE_ORIG_POINTER(avformat_new_stream);
+DEFINE_ORIG_POINTER(avformat_write_header);
+DEFINE_ORIG_POINTER(avformat_free_context);
+DEFINE_ORIG_POINTER(av_interleaved_write_frame);
+DEFINE_ORIG_POINTER(av_write_trailer);
+DEFINE_ORIG_POINTER(avio_open);
+DEFINE_ORIG_POINTER(avio_closep);
+DEFINE_ORIG_POINTER(avcodec_find_encoder_by_name);
+DEFINE_ORIG_POINTER(avcodec_alloc_context3);
+DEFINE_ORIG_POINTER(avcodec_open2);
+DEFINE_ORIG_POINTER(avcodec_parameters_from_context);
+DEFINE_ORIG_POINTER(avcodec_send_frame);
+DEFINE_ORIG_POINTER(avcodec_receive_packet);
+DEFINE_ORIG_POINTER(avcodec_free_context);
+DEFINE_ORIG_POINTER(av_packet_alloc);
+DEFINE_ORIG_POINTER(av_packet_free);
+DEFINE_ORIG_POINTER(av_packet_rescale_ts);
+DEFINE_ORIG_POINTER(av_frame_alloc);
+DEFINE_ORIG_POINTER(av_frame_free);
+DEFINE_ORIG_POINTER(av_frame_get_buffer);
+DEFINE_ORIG_POINTER(av_frame_make_writable);
+DEFINE_ORIG_POINTER(av_dict_set);
+DEFINE_ORIG_POINTER(av_dict_free);
+#if LIBAV_HAS_CH_LAYOUT
+DEFINE_ORIG_POINTER(av_channel_layout_default);
+DEFINE_ORIG_POINTER(swr_alloc_set_opts2);
+#else
+DEFINE_ORIG_POINTER(av_get_default_channel_layout);
+#endif
+DEFINE_ORIG_POINTER(sws_getContext);
+DEFINE_ORIG_POINTER(sws_scale);
+DEFINE_ORIG_POINTER(sws_freeContext);
+
+/* Already linked by AudioSource */
+#if !LIBAV_HAS_CH_LAYOUT
+DECLARE_ORIG_POINTER(swr_alloc_set_opts);
+#endif
+DECLARE_ORIG_POINTER(swr_init);
+DECLARE_ORIG_POINTER(swr_convert);
+DECLARE_ORIG_POINTER(swr_free);
+
+#define LINK_LIBAV(FUNC, LIB, MAJOR) \
+    link_function((void**)&orig::FUNC, #FUNC, "lib" LIB ".so." AV_STRINGIFY(MAJOR))
+
+static bool linkLibav()
+{
+    LINK_LIBAV(avformat_alloc_output_context2, "avformat", LIBAVFORMAT_VERSION_MAJOR);
+    LINK_LIBAV(avformat_new_stream, "avformat", LIBAVFORMAT_VERSION_MAJOR);
+    LINK_LIBAV(avformat_write_header, "avformat", LIBAVFORMAT_VERSION_MAJOR);
+    LINK_LIBAV(avformat_free_context, "avformat", LIBAVFORMAT_VERSION_MAJOR);
+    LINK_LIBAV(av_interleaved_write_frame, "avformat", LIBAVFORMAT_VERSION_MAJOR);
+    LINK_LIBAV(av_write_trailer, "avformat", LIBAVFORMAT_VERSION_MAJOR);
+    LINK_LIBAV(avio_open, "avformat", LIBAVFORMAT_VERSION_MAJOR);
+    LINK_LIBAV(avio_closep, "avformat", LIBAVFORMAT_VERSION_MAJOR);
+    LINK_LIBAV(avcodec_find_encoder_by_name, "avcodec", LIBAVCODEC_VERSION_MAJOR);
+    LINK_LIBAV(avcodec_alloc_context3, "avcodec", LIBAVCODEC_VERSION_MAJOR);
+    LINK_LIBAV(avcodec_open2, "avcodec", LIBAVCODEC_VERSION_MAJOR);
+    LINK_LIBAV(avcodec_parameters_from_context, "avcodec", LIBAVCODEC_VERSION_MAJOR);
+    LINK_LIBAV(avcodec_send_frame, "avcodec", LIBAVCODEC_VERSION_MAJOR);
+    LINK_LIBAV(avcodec_receive_packet, "avcodec", LIBAVCODEC_VERSION_MAJOR);
+    LINK_LIBAV(avcodec_free_context, "avcodec", LIBAVCODEC_VERSION_MAJOR);
+    LINK_LIBAV(av_packet_alloc, "avcodec", LIBAVCODEC_VERSION_MAJOR);
+    LINK_LIBAV(av_packet_free, "avcodec", LIBAVCODEC_VERSION_MAJOR);
+    LINK_LIBAV(av_packet_rescale_ts, "avcodec", LIBAVCODEC_VERSION_MAJOR);
+    LINK_LIBAV(av_frame_alloc, "avutil", LIBAVUTIL_VERSION_MAJOR);
+    LINK_LIBAV(av_frame_free, "avutil", LIBAVUTIL_VERSION_MAJOR);
+    LINK_LIBAV(av_frame_get_buffer, "avutil", LIBAVUTIL_VERSION_MAJOR);
+    LINK_LIBAV(av_frame_make_writable, "avutil", LIBAVUTIL_VERSION_MAJOR);
+    LINK_LIBAV(av_dict_set, "avutil", LIBAVUTIL_VERSION_MAJOR);
+    LINK_LIBAV(av_dict_free, "avutil", LIBAVUTIL_VERSION_MAJOR);
+#if LIBAV_HAS_CH_LAYOUT
+    LINK_LIBAV(av_channel_layout_default, "avutil", LIBAVUTIL_VERSION_MAJOR);
+    LINK_LIBAV(swr_alloc_set_opts2, "swresample", LIBSWRESAMPLE_VERSION_MAJOR);
+#else
+    LINK_LIBAV(av_get_default_channel_layout, "avutil", LIBAVUTIL_VERSION_MAJOR);
+    LINK_LIBAV(swr_alloc_set_opts, "swresample", LIBSWRESAMPLE_VERSION_MAJOR);
+#endif
+    LINK_LIBAV(sws_getContext, "swscale", LIBSWSCALE_VERSION_MAJOR);
+    LINK_LIBAV(sws_scale, "swscale", LIBSWSCALE_VERSION_MAJOR);
+    LINK_LIBAV(sws_freeContext, "swscale", LIBSWSCALE_VERSION_MAJOR);
+    LINK_LIBAV(swr_init, "swresample", LIBSWRESAMPLE_VERSION_MAJOR);
+    LINK_LIBAV(swr_convert, "swresample", LIBSWRESAMPLE_VERSION_MAJOR);
+    LINK_LIBAV(swr_free, "swresample", LIBSWRESAMPLE_VERSION_MAJOR);
+
+#if LIBAV_HAS_CH_LAYOUT
+    if (!orig::av_channel_layout_default || !orig::swr_alloc_set_opts2)
+        return false;
+#else
+    if (!orig::av_get_default_channel_layout || !orig::swr_alloc_set_opts)
+        return false;
+#endif
+
+    return orig::avformat_alloc_output_context2 && orig::avformat_new_stream &&
+        orig::avformat_write_header && orig::avformat_free_context &&
+        orig::av_interleaved_write_frame && orig::av_write_trailer &&
+        orig::avio_open && orig::avio_closep &&
+        orig::avcodec_find_encoder_by_name && orig::avcodec_alloc_context3 &&
+        orig::avcodec_open2 && orig::avcodec_parameters_from_context &&
+        orig::avcodec_send_frame && orig::avcodec_receive_packet &&
+        orig::avcodec_free_context && orig::av_packet_alloc &&
+        orig::av_packet_free && orig::av_packet_rescale_ts &&
+        orig::av_frame_alloc && orig::av_frame_free &&
+        orig::av_frame_get_buffer && orig::av_frame_make_writable &&
+        orig::av_dict_set && orig::av_dict_free &&
+        orig::sws_getContext && orig::sws_scale &&
+        orig::sws_freeContext && orig::swr_init &&
+        orig::swr_convert && orig::swr_free;
+}
+
+/* Get the libav pixel format from the nut fourcc */
+static AVPixelFormat fourccToPixelFormat(const char* pixfmt)
+{
+    static const struct {
+        const char* fourcc;
+        AVPixelFormat format;
+    } formats[] = {
+        {"RGBA", AV_PIX_FMT_RGBA},
+        {"BGRA", AV_PIX_FMT_BGRA},
+        {"ARGB", AV_PIX_FMT_ARGB},
+        {"ABGR", AV_PIX_FMT_ABGR},
+        {"RGB\0", AV_PIX_FMT_RGB0},
+        {"BGR\0", AV_PIX_FMT_BGR0},
+        {"\0RGB", AV_PIX_FMT_0RGB},
+        {"\0BGR", AV_PIX_FMT_0BGR},
+        {"24BG", AV_PIX_FMT_BGR24},
+        {"RAW ", AV_PIX_FMT_RGB24},
+        {"I420", AV_PIX_FMT_YUV420P},
+        {"NV12", AV_PIX_FMT_NV12},
+    };
+
+    for (const auto& f : formats) {
+        if (memcmp(pixfmt, f.fourcc, 4) == 0)
+            return f.format;
+    }
+    return AV_PIX_FMT_NONE;
+}
+
+/* Parse a bitrate like "4000k" */
+static int64_t parseBitrate(const std::string& value)
+{
+    char* end;
+    int64_t bitrate = strtoll(value.c_str(), &end, 10);
+    if (*end == 'k' || *end == 'K')
+        bitrate *= 1000;
+    else if (*end == 'M')
+        bitrate *= 1000000;
+    return bitrate;
+}
+
+LibavMuxer::LibavMuxer(const char* filename, int w, int h, int fpsnum, int fpsden, const char* pixfmt, int samplerate, int bitdepth, int channels, const char* options) : width(w), height(h)
+{
+    GlobalNative gn;
+
+    if (!linkLibav()) {
+        debuglog(LCF_DUMP | LCF_ERROR, "Could not link to libavcodec/libavformat/libswscale");
+        return;
+    }
+
+    in_pixfmt = fourccToPixelFormat(pixfmt);
+    if (in_pixfmt == AV_PIX_FMT_NONE) {
+        debuglog(LCF_DUMP | LCF_ERROR, "Unsupported pixel format");
+        return;
+    }
+
+    /* Read the codecs and bitrates from the ffmpeg options */
+    std::string video_codec = "libx264";
+    std::string audio_codec = "aac";
+    int64_t video_bitrate = 0;
+    int64_t audio_bitrate = 0;
+    AVDictionary* codec_options = nullptr;
+
+    std::istringstream iss(options);
+    std::string key, value;
+    while (iss >> key) {
+        if (key[0] != '-' || !(iss >> value))
+            continue;
+        if (key == "-c:v" || key == "-vcodec")
+            video_codec = value;
+        else if (key == "-c:a" || key == "-acodec")
+            audio_codec = value;
+        else if (key == "-b:v")
+            video_bitrate = parseBitrate(value);
+        else if (key == "-b:a")
+            audio_bitrate = parseBitrate(value);
+        else
+            orig::av_dict_set(&codec_options, key.c_str() + 1, value.c_str(), 0);
+    }
+
+    orig::avformat_alloc_output_context2(&format_context, nullptr, nullptr, filename);
+    if (!format_context) {
+        debuglog(LCF_DUMP | LCF_ERROR, "Could not find a container for ", filename);
+        orig::av_dict_free(&codec_options);
+        return;
+    }
+
+    bool opened = openVideo(video_codec.c_str(), video_bitrate, fpsnum, fpsden, &codec_options) &&
+        openAudio(audio_codec.c_str(), audio_bitrate, samplerate, bitdepth, channels);
+    orig::av_dict_free(&codec_options);
+    if (!opened)
+        return;
+
+    if (!(format_context->oformat->flags & AVFMT_NOFILE)) {
+        if (orig::avio_open(&format_context->pb, filename, AVIO_FLAG_WRITE) < 0) {
+            debuglog(LCF_DUMP | LCF_ERROR, "Could not open ", filename);
+            return;
+        }
+    }
+
+    if (orig::avformat_write_header(format_context, nullptr) < 0) {
+        debuglog(LCF_DUMP | LCF_ERROR, "Could not write the header of ", filename);
+        return;
+    }
+
+    packet = orig::av_packet_alloc();
+    valid = true;
+}
+
+bool LibavMuxer::openVideo(const char* codec_name, int64_t bitrate, int fpsnum, int fpsden, AVDictionary** codec_options)
+{
+    const AVCodec* codec = orig::avcodec_find_encoder_by_name(codec_name);
+    if (!codec) {
+        debuglog(LCF_DUMP | LCF_ERROR, "Could not find video encoder ", codec_name);
+        return false;
+    }
+
+    video_stream = orig::avformat_new_stream(format_context, nullptr);
+    video_context = orig::avcodec_alloc_context3(codec);
+
+    /* Use the captured pixel format if the encoder supports it */
+    AVPixelFormat out_pixfmt = in_pixfmt;
+    if (codec->pix_fmts) {
+        out_pixfmt = codec->pix_fmts[0];
+        for (const AVPixelFormat* p = codec->pix_fmts; *p != AV_PIX_FMT_NONE; p++) {
+            if (*p == in_pixfmt)
+                out_pixfmt = in_pixfmt;
+        }
+    }
+
+    video_context->width = width;
+    video_context->height = height;
+    video_context->pix_fmt = out_pixfmt;
+    video_context->time_base = AVRational{fpsden, fpsnum};
+    video_context->framerate = AVRational{fpsnum, fpsden};
+    if (bitrate > 0)
+        video_context->bit_rate = bitrate;
+
+    /* Let the codec encode frames on its own threads */
+    video_context->thread_count = 0;
+    video_context->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+    if (format_context->oformat->flags & AVFMT_GLOBALHEADER)
+        video_context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    if (orig::avcodec_open2(video_context, codec, codec_options) < 0) {
+        debuglog(LCF_DUMP | LCF_ERROR, "Could not open video encoder ", codec_name);
+        return false;
+    }
+
+    video_stream->time_base = video_context->time_base;
+    orig::avcodec_parameters_from_context(video_stream->codecpar, video_context);
+
+    video_frame = orig::av_frame_alloc();
+    video_frame->format = out_pixfmt;
+    video_frame->width = width;
+    video_frame->height = height;
+    orig::av_frame_get_buffer(video_frame, 0);
+
+    /* Also used for a plain copy when formats are identical */
+    sws_context = orig::sws_getContext(width, height, in_pixfmt, width, height, out_pixfmt, SWS_BILINEAR, nullptr, nullptr, nullptr);
+
+    return true;
+}
+
+bool LibavMuxer::openAudio(const char* codec_name, int64_t bitrate, int samplerate, int bitdepth, int channels)
+{
+    const AVCodec* codec = orig::avcodec_find_encoder_by_name(codec_name);
+    if (!codec) {
+        debuglog(LCF_DUMP | LCF_ERROR, "Could not find audio encoder ", codec_name);
+        return false;
+    }
+
+    audio_stream = orig::avformat_new_stream(format_context, nullptr);
+    audio_context = orig::avcodec_alloc_context3(codec);
+
+    AVSampleFormat in_format = (bitdepth == 8) ? AV_SAMPLE_FMT_U8 : AV_SAMPLE_FMT_S16;
+    AVSampleFormat out_format = in_format;
+    if (codec->sample_fmts) {
+        out_format = codec->sample_fmts[0];
+        for (const AVSampleFormat* f = codec->sample_fmts; *f != AV_SAMPLE_FMT_NONE; f++) {
+            if (*f == in_format)
+                out_format = in_format;
+        }
+    }
+
+    audio_context->sample_fmt = out_format;
+    audio_context->sample_rate = samplerate;
+#if LIBAV_HAS_CH_LAYOUT
+    orig::av_channel_layout_default(&audio_context->ch_layout, channels);
+#else
+    int64_t layout = orig::av_get_default_channel_layout(channels);
+    audio_context->channel_layout = layout;
+    audio_context->channels = channels;
+#endif
+    audio_context->time_base = AVRational{1, samplerate};
+    if (bitrate > 0)
+        audio_context->bit_rate = bitrate;
+
+    if (format_context->oformat->flags & AVFMT_GLOBALHEADER)
+        audio_context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    if (orig::avcodec_open2(audio_context, codec, nullptr) < 0) {
+        debuglog(LCF_DUMP | LCF_ERROR, "Could not open audio encoder ", codec_name);
+        return false;
+    }
+
+    audio_stream->time_base = audio_context->time_base;
+    orig::avcodec_parameters_from_context(audio_stream->codecpar, audio_context);
+
+    /* Codecs without a fixed frame size accept any number of samples */
+    audio_frame = orig::av_frame_alloc();
+    audio_frame->format = out_format;
+#if LIBAV_HAS_CH_LAYOUT
+    orig::av_channel_layout_default(&audio_frame->ch_layout, channels);
+#else
+    audio_frame->channel_layout = layout;
+#endif
+    audio_frame->sample_rate = samplerate;
+    audio_frame->nb_samples = (audio_context->frame_size > 0) ? audio_context->frame_size : 1024;
+    orig::av_frame_get_buffer(audio_frame, 0);
+
+    sample_size = channels * bitdepth / 8;
+
+    /* Same sample rate, so the conversion never buffers samples */
+#if LIBAV_HAS_CH_LAYOUT
+    orig::swr_alloc_set_opts2(&swr_context, &audio_context->ch_layout, out_format, samplerate, &audio_context->ch_layout, in_format, samplerate, 0, nullptr);
+#else
+    swr_context = orig::swr_alloc_set_opts(nullptr, layout, out_format, samplerate, layout, in_format, samplerate, 0, nullptr);
+#endif
+    orig::swr_init(swr_context);
+
+    return true;
+}
+
+bool LibavMuxer::isValid()
+{
+    return valid;
+}
+
+void LibavMuxer::encode(AVCodecContext* context, AVStream* stream, AVFrame* frame)
+{
+    if (orig::avcodec_send_frame(context, frame) < 0) {
+        debuglog(LCF_DUMP | LCF_ERROR, "Could not send a frame to the encoder");
+        return;
+    }
+
+    while (orig::avcodec_receive_packet(context, packet) == 0) {
+        orig::av_packet_rescale_ts(packet, context->time_base, stream->time_base);
+        packet->stream_index = stream->index;
+
+        /* This takes ownership of the packet data */
+        if (orig::av_interleaved_write_frame(format_context, packet) < 0)
+            debuglog(LCF_DUMP | LCF_ERROR, "Could not write a packet");
+    }
+}
+
+void LibavMuxer::writeVideoFrame(const uint8_t* video, int len)
+{
+    GlobalNative gn;
+
+    if (!valid)
+        return;
+
+    /* Planes of the captured frame */
+    const uint8_t* planes[4] = {video, nullptr, nullptr, nullptr};
+    int linesizes[4] = {0, 0, 0, 0};
+    switch (in_pixfmt) {
+        case AV_PIX_FMT_YUV420P:
+            linesizes[0] = width;
+            planes[1] = video + width * height;
+            linesizes[1] = width / 2;
+            planes[2] = planes[1] + (width / 2) * (height / 2);
+            linesizes[2] = width / 2;
+            break;
+        case AV_PIX_FMT_NV12:
+            linesizes[0] = width;
+            planes[1] = video + width * height;
+            linesizes[1] = width;
+            break;
+        default:
+            linesizes[0] = len / height;
+            break;
+    }
+
+    orig::av_frame_make_writable(video_frame);
+    orig::sws_scale(sws_context, planes, linesizes, 0, height, video_frame->data, video_frame->linesize);
+
+    video_frame->pts = video_pts++;
+    encode(video_context, video_stream, video_frame);
+}
+
+void LibavMuxer::skipVideoFrames(int count)
+{
+    video_pts += count;
+}
+
+void LibavMuxer::encodeAudio(int nb_samples)
+{
+    orig::av_frame_make_writable(audio_frame);
+
+    const uint8_t* in = audio_fifo.data();
+    orig::swr_convert(swr_context, audio_frame->data, nb_samples, &in, nb_samples);
+
+    audio_frame->nb_samples = nb_samples;
+    audio_frame->pts = audio_pts;
+    audio_pts += nb_samples;
+    encode(audio_context, audio_stream, audio_frame);
+
+    audio_fifo.erase(audio_fifo.begin(), audio_fifo.begin() + nb_samples * sample_size);
+}
+
+void LibavMuxer::writeAudioFrame(const uint8_t* samples, int len)
+{
+    GlobalNative gn;
+
+    if (!valid)
+        return;
+
+    audio_fifo.insert(audio_fifo.end(), samples, samples + len);
+
+    /* Encoders take frames of a fixed number of samples */
+    int frame_size = (audio_context->frame_size > 0) ? audio_context->frame_size : 1024;
+    while (static_cast<int>(audio_fifo.size()) >= frame_size * sample_size)
+        encodeAudio(frame_size);
+}
+
+LibavMuxer::~LibavMuxer()
+{
+    GlobalNative gn;
+
+    if (valid) {
+        /* Encode the remaining samples as a smaller last frame */
+        if (!audio_fifo.empty())
+            encodeAudio(audio_fifo.size() / sample_size);
+
+        /* Flush the encoders */
+        encode(video_context, video_stream, nullptr);
+        encode(audio_context, audio_stream, nullptr);
+
+        orig::av_write_trailer(format_context);
+    }
+
+    if (sws_context)
+        orig::sws_freeContext(sws_context);
+    if (swr_context)
+        orig::swr_free(&swr_context);
+    if (video_frame)
+        orig::av_frame_free(&video_frame);
+    if (audio_frame)
+        orig::av_frame_free(&audio_frame);
+    if (packet)
+        orig::av_packet_free(&packet);
+    if (video_context)
+        orig::avcodec_free_context(&video_context);
+    if (audio_context)
+        orig::avcodec_free_context(&audio_context);
+
+    if (format_context) {
+        if (!(format_context->oformat->flags & AVFMT_NOFILE) && format_context->pb)
+            orig::avio_closep(&format_context->pb);
+        orig::avformat_free_context(format_context);
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,112 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_LIBAVMUXER_H_INCL
+#define LIBTAS_LIBAVMUXER_H_INCL
+
+#include "config.h"
+#ifdef LIBTAS_HAS_LIBAV
+
+#include <vector>
+#include <cstdint>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+#include <libswresample/swresample.h>
+}
+
+namespace libtas {
+
+/* Encode and mux audio and video frames inside the game process, using
+ * libavcodec and libavformat, instead of piping a nut stream into an ffmpeg
+ * process. Libraries are linked dynamically, with the major version that
+ * libTAS was built against. Codecs use their own threads, so that frames
+ * are encoded in parallel.
+ */
+class LibavMuxer {
+    public:
+        /* @param filename       Path of the encoded file, the container is guessed from the extension
+         * @param width          Width of video frames
+         * @param height         Height of video frames
+         * @param fpsnum         Framerate numerator
+         * @param fpsden         Framerate denominator
+         * @param pixfmt         Fourcc of the video frames
+         * @param samplerate     Audio sample rate
+         * @param bitdepth       Bit depth of audio samples (8 or 16)
+         * @param channels       Number of audio channels
+         * @param options        ffmpeg-like options. Codecs and bitrates are read
+         *                       from -c:v, -c:a, -b:v and -b:a, other options are
+         *                       passed to the video codec.
+         */
+        LibavMuxer(const char* filename, int width, int height, int fpsnum, int fpsden, const char* pixfmt, int samplerate, int bitdepth, int channels, const char* options);
+
+        /* Flush the encoders and write the trailer */
+        ~LibavMuxer();
+
+        /* Was the muxer successfully initialized? */
+        bool isValid();
+
+        void writeVideoFrame(const uint8_t* video, int len);
+
+        /* Advance the video timestamp without encoding frames, so that the
+         * last frame is held */
+        void skipVideoFrames(int count);
+
+        void writeAudioFrame(const uint8_t* samples, int len);
+
+    private:
+        bool valid = false;
+
+        AVFormatContext* format_context = nullptr;
+
+        AVCodecContext* video_context = nullptr;
+        AVStream* video_stream = nullptr;
+        AVFrame* video_frame = nullptr;
+        SwsContext* sws_context = nullptr;
+        AVPixelFormat in_pixfmt;
+        int width, height;
+        int64_t video_pts = 0;
+
+        AVCodecContext* audio_context = nullptr;
+        AVStream* audio_stream = nullptr;
+        AVFrame* audio_frame = nullptr;
+        SwrContext* swr_context = nullptr;
+        int sample_size;
+        int64_t audio_pts = 0;
+
+        /* Samples waiting to fill a complete audio frame */
+        std::vector<uint8_t> audio_fifo;
+
+        AVPacket* packet = nullptr;
+
+        bool openVideo(const char* codec_name, int64_t bitrate, int fpsnum, int fpsden, AVDictionary** codec_options);
+        bool openAudio(const char* codec_name, int64_t bitrate, int samplerate, int bitdepth, int channels);
+
+        /* Encode an audio frame from the start of the fifo */
+        void encodeAudio(int nb_samples);
+
+        /* Send a frame to the encoder (nullptr to flush), and write all available packets */
+        void encode(AVCodecContext* context, AVStream* stream, AVFrame* frame);
+};
+
+}
+
+#endif
+#endif
@@ -199,6 +199,11 @@ void NutMuxer::writeMainHeader()
 	header_packet.flush();
 }
 
+bool NutMuxer::isYuvFormat(const char* pixfmt)
+{
+	return (memcmp(pixfmt, "I420", 4) == 0) || (memcmp(pixfmt, "NV12", 4) == 0);
+}
+
 void NutMuxer::writeVideoHeader()
 {
 	debuglog(LCF_DUMP, "Write nut video header");
@@ -212,7 +217,7 @@ void NutMuxer::writeVideoHeader()
 	writeVarU(8, header_packet.data); // msb_pts_shift
 	writeVarU(1, header_packet.data); // max_pts_distance
 	writeVarU(0, header_packet.data); // decode_delay
-	writeVarU(1, header_packet.data); // stream_flags = FLAG_FIXED_FPS
+	writeVarU(0, header_packet.data); // stream_flags = none; no FIXED_FPS because identical frames are skipped
 	writeBytes("", 0, header_packet.data); // codec_specific_data
 
 	// stream_class = video
@@ -220,7 +225,10 @@ void NutMuxer::writeVideoHeader()
 	writeVarU(avparams.height, header_packet.data); // height
 	writeVarU(1, header_packet.data); // sample_width
 	writeVarU(1, header_packet.data); // sample_height
-	writeVarU(18, header_packet.data); // colorspace_type = full range rec709 (avisynth's "PC.709")
+	if (isYuvFormat(avparams.pixfmt))
+		writeVarU(1, header_packet.data); // colorspace_type = ITU-R BT.601, matching the conversion done by FrameConverter
+	else
+		writeVarU(18, header_packet.data); // colorspace_type = full range rec709 (avisynth's "PC.709")
 
 	header_packet.flush();
 }
@@ -303,6 +311,12 @@ void NutMuxer::writeVideoFrame(const uint8_t* video, int len)
 
 }
 
+void NutMuxer::skipVideoFrames(int count)
+{
+	debuglog(LCF_DUMP, "Skip ", count, " nut video frame(s)");
+	videopts += static_cast<uint64_t>(count);
+}
+
 void NutMuxer::writeAudioFrame(const uint8_t* samples, int len)
 {
 	debuglog(LCF_DUMP, "Write nut audio frame");
@@ -108,6 +108,11 @@ public:
 	/// </summary>
 	void writeMainHeader();
 
+	/// <summary>
+	/// is the video fourcc a YUV format?
+	/// </summary>
+	static bool isYuvFormat(const char* pixfmt);
+
 	/// <summary>
 	/// write out the 0th stream header (video)
 	/// </summary>
@@ -122,6 +127,11 @@ public:
 
     void writeVideoFrame(const uint8_t* video, int len);
 
+	/// <summary>
+	/// advance the video pts without writing frames, so that the last frame is held
+	/// </summary>
+    void skipVideoFrames(int count);
+
     void writeAudioFrame(const uint8_t* samples, int len);
 
 	NutMuxer(int width, int height, int fpsnum, int fpsden, const char* pixfmt, int samplerate, int samplesize, int channels, FILE *underlying);
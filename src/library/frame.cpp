@@ -247,6 +247,9 @@ void frameBoundary(std::function<void()> draw)
     /* Other threads may send socket messages, so we lock the socket */
     lockSocket();
 
+    /* Gather all messages so that they are sent at once */
+    beginSendBatch();
+
     /* Send framecount and internal time */
     sendMessage(MSGB_FRAMECOUNT_TIME);
     sendData(&framecount, sizeof(uint64_t));
@@ -282,6 +285,7 @@ void frameBoundary(std::function<void()> draw)
 
     /* Last message to send */
     sendMessage(MSGB_START_FRAMEBOUNDARY);
+    endSendBatch();
 
 #ifdef LIBTAS_ENABLE_HUD
     /* Get ramwatches from the program */
@@ -603,6 +607,10 @@ static void receive_messages(std::function<void()> draw)
                 receiveData(&shared_config, sizeof(SharedConfig));
                 break;
 
+            case MSGN_CONFIG_DELTA:
+                receiveSharedConfigDelta(shared_config);
+                break;
+
             case MSGN_DUMP_FILE:
                 debuglog(LCF_SOCKET, "Receiving dump filename");
                 receiveCString(AVEncoder::dumpfile);
@@ -681,6 +689,7 @@ static void receive_messages(std::function<void()> draw)
                     /* We must send again the frame count and time because it
                      * probably has changed.
                      */
+                    beginSendBatch();
                     sendMessage(MSGB_FRAMECOUNT_TIME);
                     sendData(&framecount, sizeof(uint64_t));
                     struct timespec ticks = detTimer.getTicks();
@@ -688,6 +697,7 @@ static void receive_messages(std::function<void()> draw)
                     sendData(&ticks_val, sizeof(uint64_t));
                     ticks_val = ticks.tv_nsec;
                     sendData(&ticks_val, sizeof(uint64_t));
+                    endSendBatch();
 
                     /* Screen should have changed after loading */
                     if (draw)
@@ -728,6 +738,7 @@ static void receive_messages(std::function<void()> draw)
                  * frame count and time because the program will pull a
                  * message in either case.
                  */
+                beginSendBatch();
                 sendMessage(MSGB_FRAMECOUNT_TIME);
                 sendData(&framecount, sizeof(uint64_t));
                 {
@@ -737,6 +748,7 @@ static void receive_messages(std::function<void()> draw)
                     ticks_val = ticks.tv_nsec;
                     sendData(&ticks_val, sizeof(uint64_t));
                 }
+                endSendBatch();
 
                 break;
 
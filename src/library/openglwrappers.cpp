@@ -84,6 +84,15 @@ DEFINE_ORIG_POINTER(glActiveTexture);
 DEFINE_ORIG_POINTER(glFramebufferTexture2D);
 DEFINE_ORIG_POINTER(glUseProgram);
 DEFINE_ORIG_POINTER(glPixelStorei);
+DEFINE_ORIG_POINTER(glGenBuffers);
+DEFINE_ORIG_POINTER(glDeleteBuffers);
+DEFINE_ORIG_POINTER(glBindBuffer);
+DEFINE_ORIG_POINTER(glBufferData);
+DEFINE_ORIG_POINTER(glMapBufferRange);
+DEFINE_ORIG_POINTER(glUnmapBuffer);
+DEFINE_ORIG_POINTER(glFenceSync);
+DEFINE_ORIG_POINTER(glClientWaitSync);
+DEFINE_ORIG_POINTER(glDeleteSync);
 
 #define GLFUNCSKIPDRAW(NAME, DECL, ARGS) \
 DEFINE_ORIG_POINTER(NAME)\
@@ -507,7 +516,7 @@ void glXDestroyContext(Display * dpy,  GLXContext ctx)
 {
     DEBUGLOGCALL(LCF_WINDOW | LCF_OGL);
     LINK_NAMESPACE(glXDestroyContext, "GL");
-    ScreenCapture::fini();
+    ScreenCapture::fini(ctx);
     return orig::glXDestroyContext(dpy, ctx);
 }
 
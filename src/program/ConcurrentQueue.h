@@ -20,42 +20,120 @@
 #ifndef LIBTAS_CONCURRENTQUEUE_H_INCLUDED
 #define LIBTAS_CONCURRENTQUEUE_H_INCLUDED
 
-#include <queue>
-#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
 
-/* Thread-safe queue, will be used for a single producer/single consumer model
- * taken from https://juanchopanzacpp.wordpress.com/2013/02/26/concurrent-queue-c11/
+/* Bounded lock-free queue for a single producer/single consumer model.
+ * Elements are stored in a ring buffer of N slots (N must be a power of two).
+ * The producer only writes `tail_` and the consumer only writes `head_`, so
+ * no lock is needed as long as there is at most one thread on each side.
+ *
+ * The queue also owns an eventfd that is signaled on each push, so that the
+ * consumer can sleep until an element is available with wait(), or add the
+ * descriptor from fd() to its own poll/epoll set.
  */
-template <typename T>
+template <typename T, size_t N = 256>
 class ConcurrentQueue {
+    static_assert((N & (N - 1)) == 0, "ConcurrentQueue size must be a power of two");
+
 public:
 
     bool empty() const
     {
-        /* We should not need to protect this function with a mutex */
-        return queue_.empty();
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
     }
 
-    void pop(T& item)
+    /* Get the oldest element. Returns false if the queue was empty.
+     * Must only be called by the consumer thread. */
+    bool pop(T& item)
     {
-        std::unique_lock<std::mutex> mlock(mutex_);
-        item = queue_.front();
-        queue_.pop();
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire))
+            return false;
+
+        item = buffer_[head & (N - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
     }
 
-    void push(const T& item)
+    /* Push an element and wake up the consumer. Returns false if the queue
+     * is full, in which case the element is dropped.
+     * Must only be called by the producer thread. */
+    bool push(const T& item)
     {
-        std::unique_lock<std::mutex> mlock(mutex_);
-        queue_.push(item);
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if ((tail - head_.load(std::memory_order_acquire)) == N)
+            return false;
+
+        buffer_[tail & (N - 1)] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+
+        notify();
+        return true;
     }
 
-    ConcurrentQueue()=default;
+    /* Block until the queue is not empty, or until timeout_ms milliseconds
+     * have passed (-1 for no timeout). Returns if the queue is not empty.
+     * Must only be called by the consumer thread. */
+    bool wait(int timeout_ms)
+    {
+        if (!empty())
+            return true;
+
+        if (efd_ < 0)
+            return false;
+
+        struct pollfd pfd = {efd_, POLLIN, 0};
+        if (poll(&pfd, 1, timeout_ms) > 0)
+            clearNotification();
+
+        return !empty();
+    }
+
+    /* Wake up the consumer without pushing an element, so that it can
+     * notice a state change made outside of the queue */
+    void notify()
+    {
+        if (efd_ >= 0) {
+            uint64_t one = 1;
+            ssize_t ret = write(efd_, &one, sizeof(one));
+            (void) ret;
+        }
+    }
+
+    /* Reset the eventfd counter after it was reported readable */
+    void clearNotification()
+    {
+        uint64_t count;
+        ssize_t ret = read(efd_, &count, sizeof(count));
+        (void) ret;
+    }
+
+    /* File descriptor that becomes readable when an element is pushed */
+    int fd() const
+    {
+        return efd_;
+    }
+
+    ConcurrentQueue() : efd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+    ~ConcurrentQueue()
+    {
+        if (efd_ >= 0)
+            close(efd_);
+    }
     ConcurrentQueue(const ConcurrentQueue&) = delete;            // disable copying
     ConcurrentQueue& operator=(const ConcurrentQueue&) = delete; // disable assignment
 
 private:
-    std::queue<T> queue_;
-    std::mutex mutex_;
+    /* Keep the consumer and producer indices on separate cache lines */
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    alignas(64) T buffer_[N];
+    int efd_;
 };
 
 #endif
@@ -131,6 +131,9 @@ void Config::save(const std::string& gamepath) {
     settings.setValue("video_codec", sc.video_codec);
     settings.setValue("video_bitrate", sc.video_bitrate);
     settings.setValue("video_framerate", sc.video_framerate);
+    settings.setValue("video_pixfmt", sc.video_pixfmt);
+    settings.setValue("video_downscale", sc.video_downscale);
+    settings.setValue("encode_backend", sc.encode_backend);
     settings.setValue("audio_codec", sc.audio_codec);
     settings.setValue("audio_bitrate", sc.audio_bitrate);
     settings.setValue("locale", sc.locale);
@@ -267,6 +270,9 @@ void Config::load(const std::string& gamepath) {
     sc.video_codec = settings.value("video_codec", sc.video_codec).toInt();
     sc.video_bitrate = settings.value("video_bitrate", sc.video_bitrate).toInt();
     sc.video_framerate = settings.value("video_framerate", sc.video_framerate).toInt();
+    sc.video_pixfmt = settings.value("video_pixfmt", sc.video_pixfmt).toInt();
+    sc.video_downscale = settings.value("video_downscale", sc.video_downscale).toInt();
+    sc.encode_backend = settings.value("encode_backend", sc.encode_backend).toInt();
     sc.audio_codec = settings.value("audio_codec", sc.audio_codec).toInt();
     sc.audio_bitrate = settings.value("audio_bitrate", sc.audio_bitrate).toInt();
     sc.save_screenpixels = settings.value("save_screenpixels", sc.save_screenpixels).toBool();
@@ -124,6 +124,15 @@ struct Context {
 
     /* Interactive mode */
     bool interactive = true;
+
+    /* Headless mode: no UI, the movie is played as fast as possible */
+    bool headless = false;
+
+    /* Range of frames that are encoded in headless mode, used by split
+     * rendering. The encode starts after frame encode_start_frame and stops
+     * after frame encode_end_frame, or at the end of the movie if 0. */
+    uint64_t encode_start_frame = 0;
+    uint64_t encode_end_frame = 0;
 };
 
 #endif
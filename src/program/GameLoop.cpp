@@ -43,6 +43,7 @@
 #include <csignal> // kill
 #include <sys/stat.h> // stat
 #include <sys/wait.h> // waitpid
+#include <sys/epoll.h>
 #include <X11/X.h>
 
 #include <sys/personality.h>
@@ -51,7 +52,7 @@
 # define personality(pers) ((long)syscall(SYS_personality, pers))
 #endif
 
-GameLoop::GameLoop(Context* c) : context(c), keysyms(xcb_key_symbols_alloc(c->conn), xcb_key_symbols_free) {
+GameLoop::GameLoop(Context* c) : context(c), keysyms(xcb_key_symbols_alloc(c->conn), xcb_key_symbols_free), epoll_fd(-1) {
     movie = MovieFile(context);
 }
 
@@ -291,6 +292,9 @@ void GameLoop::start()
 {
     init();
     initProcessMessages();
+    initEventPoll();
+
+    struct timespec boundary_start, boundary_end = {0, 0};
 
     while (1)
     {
@@ -300,6 +304,12 @@ void GameLoop::start()
             return;
         }
 
+        clock_gettime(CLOCK_MONOTONIC, &boundary_start);
+        if (boundary_end.tv_sec != 0) {
+            stats.game_sec += (boundary_start.tv_sec - boundary_end.tv_sec) +
+                (boundary_start.tv_nsec - boundary_end.tv_nsec) / 1000000000.0;
+        }
+
         /* We are at a frame boundary */
         /* If we did not yet receive the game window id, just make the game running */
         bool endInnerLoop = false;
@@ -334,7 +344,8 @@ void GameLoop::start()
                 hasFrameAdvanced || (context->status == Context::QUITTING);
 
             if (!endInnerLoop) {
-                sleepSendPreview();
+                sendPreview();
+                waitForEvents();
             }
         } while (!endInnerLoop);
 
@@ -357,6 +368,7 @@ void GameLoop::start()
             if (!context->interactive) {
                 /* Quit at the end of the movie if non-interactive */
                 shouldQuit = true;
+                movie_end_reached = true;
             } else {
                 /* Disable pause */
                 context->pause_frame = 0;
@@ -369,8 +381,33 @@ void GameLoop::start()
             }
         }
 
+        /* Only encode a range of frames when split rendering. Frames
+         * before the range are played without rendering */
+        if (context->headless && context->config.dumping) {
+            if ((context->encode_start_frame > 0) && (context->framecount == context->encode_start_frame)) {
+                context->config.sc.av_dumping = true;
+                context->config.sc.fastforward_mode &= ~SharedConfig::FF_RENDERING;
+                context->config.sc_modified = true;
+                context->config.dumpfile_modified = true;
+            }
+            if ((context->encode_end_frame > 0) && (context->framecount == context->encode_end_frame)) {
+                context->config.sc.av_dumping = false;
+                context->config.sc_modified = true;
+
+                /* Finish the encode now, the game is quitting */
+                sendMessage(MSGN_STOP_ENCODE);
+                shouldQuit = true;
+                movie_end_reached = true;
+            }
+        }
+
         endFrameMessages(ai);
 
+        clock_gettime(CLOCK_MONOTONIC, &boundary_end);
+        stats.boundary_sec += (boundary_end.tv_sec - boundary_start.tv_sec) +
+            (boundary_end.tv_nsec - boundary_start.tv_nsec) / 1000000000.0;
+        stats.frames++;
+
         if (shouldQuit) {
             context->status = Context::QUITTING;
         }
@@ -397,6 +434,11 @@ void GameLoop::init()
     if (context->status != Context::RESTARTING)
         context->encoding_segment = 0;
 
+    /* Reset the loop statistics if not restarting */
+    if (context->status != Context::RESTARTING)
+        stats = LoopStats();
+    movie_end_reached = false;
+
     /* Extract the game executable name from the game executable path */
     context->gamename = fileFromPath(context->gamepath);
 
@@ -408,6 +450,7 @@ void GameLoop::init()
 
     last_pressed_key = 0;
     next_event = nullptr;
+    backtrack_savestate_pending = false;
 
     /* Remove savestates again in case we did not exist cleanly the previous time */
     remove_savestates(context);
@@ -542,6 +585,7 @@ void GameLoop::initProcessMessages()
     context->config.sc.initial_time_nsec = context->current_time_nsec;
     sendMessage(MSGN_CONFIG);
     sendData(&context->config.sc, sizeof(SharedConfig));
+    sent_sc = context->config.sc;
     context->config.sc.initial_time_sec = it.tv_sec;
     context->config.sc.initial_time_nsec = it.tv_nsec;
 
@@ -599,7 +643,8 @@ bool GameLoop::startFrameMessages()
             uint32_t int_window;
             receiveData(&int_window, sizeof(uint32_t));
             context->game_window = (Window)int_window;
-            if (context->game_window != 0)
+            /* Don't listen to the game window events in headless mode */
+            if ((context->game_window != 0) && !context->headless)
             {
                 const static uint32_t values[] = { XCB_EVENT_MASK_KEY_PRESS | XCB_EVENT_MASK_KEY_RELEASE | XCB_EVENT_MASK_FOCUS_CHANGE | XCB_EVENT_MASK_EXPOSURE };
                 xcb_void_cookie_t cwa_cookie = xcb_change_window_attributes (context->conn, context->game_window, XCB_CW_EVENT_MASK, values);
@@ -668,7 +713,8 @@ bool GameLoop::startFrameMessages()
             receiveData(&context->encoding_segment, sizeof(int));
             break;
         case MSGB_DO_BACKTRACK_SAVESTATE:
-            context->hotkey_pressed_queue.push(HOTKEY_SAVESTATE_BACKTRACK);
+            /* The hotkey queues only accept pushes from the UI thread */
+            backtrack_savestate_pending = true;
             break;
         case MSGB_GETTIME_BACKTRACE:
         {
@@ -682,7 +728,7 @@ bool GameLoop::startFrameMessages()
         break;
 
         case MSGB_QUIT:
-            if (!context->interactive) {
+            if (!context->interactive && !context->headless) {
                 /* Exit the program when game has exit */
                 exit(0);
             }
@@ -697,6 +743,11 @@ bool GameLoop::startFrameMessages()
         message = receiveMessage();
     }
 
+    emit recordMemory(context->framecount);
+
+    /* Gather all messages so that they are sent at once */
+    beginSendBatch();
+
     /* Send ram watches */
     if (context->config.sc.osd & SharedConfig::OSD_RAMWATCHES) {
         std::string ramwatch;
@@ -709,6 +760,7 @@ bool GameLoop::startFrameMessages()
     }
 
     sendMessage(MSGN_START_FRAMEBOUNDARY);
+    endSendBatch();
 
     return false;
 }
@@ -728,14 +780,18 @@ uint8_t GameLoop::nextEvent(struct HotKey &hk)
 
         if (!event) {
 
-            if (!context->hotkey_pressed_queue.empty()) {
-                /* Processing a pressed hotkey pushed by the UI */
-                context->hotkey_pressed_queue.pop(hk.type);
+            if (backtrack_savestate_pending) {
+                /* Processing a backtrack savestate requested by the game */
+                backtrack_savestate_pending = false;
+                hk.type = HOTKEY_SAVESTATE_BACKTRACK;
                 return XCB_KEY_PRESS;
             }
-            else if (!context->hotkey_released_queue.empty()) {
+            else if (context->hotkey_pressed_queue.pop(hk.type)) {
                 /* Processing a pressed hotkey pushed by the UI */
-                context->hotkey_released_queue.pop(hk.type);
+                return XCB_KEY_PRESS;
+            }
+            else if (context->hotkey_released_queue.pop(hk.type)) {
+                /* Processing a released hotkey pushed by the UI */
                 return XCB_KEY_RELEASE;
             }
             else {
@@ -1170,6 +1226,7 @@ bool GameLoop::processEvent(uint8_t type, struct HotKey &hk)
                  */
                 sendMessage(MSGN_CONFIG);
                 sendData(&context->config.sc, sizeof(SharedConfig));
+                sent_sc = context->config.sc;
 
                 if ((context->config.sc.recording == SharedConfig::RECORDING_WRITE) || load_branch) {
                     /* When in writing move or loading a branch,
@@ -1378,12 +1435,93 @@ bool GameLoop::processEvent(uint8_t type, struct HotKey &hk)
 }
 
 
-void GameLoop::sleepSendPreview()
+void GameLoop::initEventPoll()
 {
-    /* Sleep a bit to not surcharge the processor */
-    struct timespec tim = {0, 17L*1000L*1000L};
-    nanosleep(&tim, NULL);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        std::cerr << "Could not create epoll instance" << std::endl;
+        return;
+    }
+
+    /* Events are only used to wake up, the sources are checked each
+     * iteration of the loop anyway. */
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+
+    ev.data.fd = xcb_get_file_descriptor(context->conn);
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev);
 
+    ev.data.fd = context->hotkey_pressed_queue.fd();
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+
+    ev.data.fd = context->hotkey_released_queue.fd();
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+
+    /* The game does not send anything while we are paused, so the socket
+     * only becomes readable when the game exits or crashes */
+    game_socket_polled = true;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.fd = getSocketFd();
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+}
+
+void GameLoop::waitForEvents()
+{
+    /* Send our pending requests before sleeping */
+    xcb_flush(context->conn);
+
+    /* Events may already have been read from the X connection by another xcb
+     * call and be stored in the xcb queue, where epoll cannot see them. */
+    if (next_event)
+        return;
+    next_event = xcb_poll_for_queued_event(context->conn);
+    if (next_event)
+        return;
+
+    if (epoll_fd < 0) {
+        /* Fallback to sleeping a bit to not surcharge the processor */
+        struct timespec tim = {0, 17L*1000L*1000L};
+        nanosleep(&tim, NULL);
+        return;
+    }
+
+    /* We still need to wake up periodically when frame-advance auto-repeat
+     * is counting ticks, when the input preview must follow the keyboard and
+     * mouse state, or when we lost track of the game socket. */
+    int timeout = -1;
+    if ((ar_ticks >= 0) || !game_socket_polled)
+        timeout = 17;
+#ifdef LIBTAS_ENABLE_HUD
+    if ((context->config.sc.recording != SharedConfig::RECORDING_READ) &&
+        (context->config.sc.osd & SharedConfig::OSD_INPUTS))
+        timeout = 17;
+#endif
+
+    struct epoll_event events[4];
+    int nfds;
+    do {
+        nfds = epoll_wait(epoll_fd, events, 4, timeout);
+    } while ((nfds == -1) && (errno == EINTR));
+
+    for (int i = 0; i < nfds; i++) {
+        int fd = events[i].data.fd;
+        if (fd == context->hotkey_pressed_queue.fd()) {
+            context->hotkey_pressed_queue.clearNotification();
+        }
+        else if (fd == context->hotkey_released_queue.fd()) {
+            context->hotkey_released_queue.clearNotification();
+        }
+        else if (fd == getSocketFd()) {
+            /* The socket will stay readable, so stop watching it and let
+             * the waitpid() check of the loop detect the game exit. */
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+            game_socket_polled = false;
+        }
+    }
+}
+
+void GameLoop::sendPreview()
+{
     /* Send a preview of inputs so that the game can display them
      * on the HUD */
 #ifdef LIBTAS_ENABLE_HUD
@@ -1569,11 +1707,14 @@ void GameLoop::endFrameMessages(AllInputs &ai)
         context->config.sc_modified = true;
     }
 
+    /* Gather all messages so that they are sent at once */
+    beginSendBatch();
+
     /* Send shared config if modified */
     if (context->config.sc_modified) {
-        /* Send config */
-        sendMessage(MSGN_CONFIG);
-        sendData(&context->config.sc, sizeof(SharedConfig));
+        /* Only send the modified fields */
+        sendMessage(MSGN_CONFIG_DELTA);
+        sendSharedConfigDelta(context->config.sc, sent_sc);
         context->config.sc_modified = false;
     }
 
@@ -1594,6 +1735,7 @@ void GameLoop::endFrameMessages(AllInputs &ai)
     }
 
     sendMessage(MSGN_END_FRAMEBOUNDARY);
+    endSendBatch();
 }
 
 
@@ -1616,6 +1758,11 @@ bool GameLoop::haveFocus()
 
 void GameLoop::loopExit()
 {
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+
     /* We need to restart the game if we got a restart input, or if:
      * - auto-restart is set
      * - we are playing or recording a movie
@@ -1643,7 +1790,8 @@ void GameLoop::loopExit()
         return;
     }
 
-    if (movie.modifiedSinceLastSave) {
+    /* Nobody can answer in headless mode */
+    if (movie.modifiedSinceLastSave && !context->headless) {
 
         /* Ask the user if he wants to save the movie, and get the answer.
          * Prompting a alert window must be done by the UI thread, so we are
@@ -34,6 +34,16 @@ public:
     void start();
     MovieFile movie;
 
+    /* Time statistics of the frame loop, reported in headless mode */
+    struct LoopStats {
+        uint64_t frames = 0;
+        double boundary_sec = 0; // time spent by us inside frame boundaries
+        double game_sec = 0; // time spent by the game between frame boundaries
+    } stats;
+
+    /* Did we quit because the end of the movie was reached */
+    bool movie_end_reached = false;
+
 private:
     Context* context;
 
@@ -56,6 +66,9 @@ private:
     /* Inputs from the previous frame */
     AllInputs prev_ai;
 
+    /* Last config sent to the game, used to only send modified fields */
+    SharedConfig sent_sc;
+
     /* Calibration offsets */
     int pointer_offset_x;
     int pointer_offset_y;
@@ -63,9 +76,18 @@ private:
     xcb_keycode_t last_pressed_key;
     xcb_generic_event_t *next_event;
 
+    /* The game asked for a backtrack savestate */
+    bool backtrack_savestate_pending;
+
     /* parent window of game window */
     xcb_window_t parent_game_window = 0;
 
+    /* epoll instance used to wait for events while the game is paused */
+    int epoll_fd;
+
+    /* Is the game socket still in the epoll set */
+    bool game_socket_polled;
+
     void init();
 
     void initProcessMessages();
@@ -85,7 +107,14 @@ private:
 
     bool processEvent(uint8_t type, struct HotKey &hk);
 
-    void sleepSendPreview();
+    /* Build the epoll set of the X connection, the hotkey queues and the
+     * game socket */
+    void initEventPoll();
+
+    /* Block until an event arrives from any of the sources above */
+    void waitForEvents();
+
+    void sendPreview();
 
     void processInputs(AllInputs &ai);
 
@@ -122,6 +151,11 @@ signals:
 
     void getRamWatch(std::string &watch);
 
+    /* Record the game memory for the RAM search frame history. Must be
+     * connected with Qt::DirectConnection, because the game is only
+     * paused during the frame boundary. */
+    void recordMemory(unsigned long long framecount);
+
     /* register a savestate */
     void savestatePerformed(int slot, unsigned long long frame);
 
@@ -21,12 +21,16 @@
 #include <QApplication>
 
 #include "ui/MainWindow.h"
+#include "ui/ErrorChecking.h"
+#include "GameLoop.h"
 #include "Context.h"
+#include "MovieFile.h"
 #include "utils.h" // create_dir
 
 #include <limits.h> // PATH_MAX
 #include <libgen.h> // dirname
 #include <signal.h> // kill
+#include <sys/wait.h> // waitpid
 #include <xcb/xcb.h>
 #define explicit _explicit
 #include <xcb/xkb.h>
@@ -35,10 +39,13 @@
 #include <unistd.h>
 #include <string.h>
 #include <string>
+#include <vector>
 #include <fstream>
+#include <sstream>
 #include <iostream>
 #include <fcntl.h>
 #include <getopt.h>
+#include <time.h>
 
 Context context;
 
@@ -50,9 +57,216 @@ static void print_usage(void)
     std::cout << "  -r, --read MOVIE        Play game inputs from MOVIE file" << std::endl;
     std::cout << "  -w, --write MOVIE       Record game inputs into the specified MOVIE file" << std::endl;
     std::cout << "  -n, --non-interactive   Don't offer any interactive choice, so that it can run headless" << std::endl;
+    std::cout << "      --headless          Play the movie given with -r as fast as possible without any UI," << std::endl;
+    std::cout << "                          print throughput statistics and return a non-zero status on failure" << std::endl;
+    std::cout << "      --split N           Headless encode of the movie given with -r into the file given with -d," << std::endl;
+    std::cout << "                          split into N segments encoded by parallel game instances. Segments are" << std::endl;
+    std::cout << "                          joined without reencoding, so lossy audio may click at segment boundaries" << std::endl;
     std::cout << "  -h, --help              Show this message" << std::endl;
 }
 
+/* Play the movie without any UI, and report the time spent in each part of
+ * the frame loop. Returns 0 if the movie was played until the end. */
+static int runHeadless(void)
+{
+    if (context.config.sc.recording != SharedConfig::RECORDING_READ) {
+        std::cerr << "Headless mode requires a movie to play with -r" << std::endl;
+        return 2;
+    }
+
+    if (!ErrorChecking::allChecks(&context))
+        return 2;
+
+    /* Play at maximum speed. Rendering is still needed when dumping */
+    context.config.sc.running = true;
+    context.config.sc.fastforward = true;
+    context.config.sc.fastforward_mode = SharedConfig::FF_SLEEP | SharedConfig::FF_MIXING;
+    if (context.config.dumping && (context.encode_start_frame == 0))
+        context.config.sc.av_dumping = true;
+    else
+        context.config.sc.fastforward_mode |= SharedConfig::FF_RENDERING;
+    context.config.sc.osd = 0;
+
+    /* The game loop runs in this thread, so alerts are printed directly */
+    GameLoop gameLoop(&context);
+    QObject::connect(&gameLoop, &GameLoop::alertToShow, [](QString str) {
+        std::cerr << str.toStdString() << std::endl;
+    });
+
+    struct timespec start_time, end_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    context.status = Context::STARTING;
+    do {
+        gameLoop.start();
+    } while (context.status == Context::RESTARTING);
+
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double total_sec = (end_time.tv_sec - start_time.tv_sec) +
+        (end_time.tv_nsec - start_time.tv_nsec) / 1000000000.0;
+
+    const GameLoop::LoopStats& stats = gameLoop.stats;
+    double loop_sec = stats.boundary_sec + stats.game_sec;
+    std::cout << "Played " << stats.frames << " frames in " << total_sec << " s";
+    if (loop_sec > 0) {
+        std::cout << " (" << stats.frames / loop_sec << " fps excluding startup)" << std::endl;
+        std::cout << "Frame boundary: " << stats.boundary_sec << " s (" << 100 * stats.boundary_sec / loop_sec << "%)" << std::endl;
+        std::cout << "Game: " << stats.game_sec << " s (" << 100 * stats.game_sec / loop_sec << "%)" << std::endl;
+    }
+    else {
+        std::cout << std::endl;
+    }
+
+    if (!gameLoop.movie_end_reached) {
+        std::cerr << "The game stopped before the end of the movie" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/* Encode the movie in several segments by parallel headless instances of
+ * libTAS, and concatenate the segments without reencoding. Each instance
+ * plays the movie without rendering until the start of its segment.
+ * Because the audio of each segment is encoded separately, lossy audio codecs
+ * add their own priming samples and padding at each boundary, which can be
+ * heard as small gaps or clicks. Using a lossless or PCM audio codec in the
+ * encode options avoids them. */
+static int runSplitHeadless(int split_count, const std::string& binpath)
+{
+    if ((context.config.sc.recording != SharedConfig::RECORDING_READ) || !context.config.dumping) {
+        std::cerr << "Split rendering requires a movie to play with -r and a file to encode with -d" << std::endl;
+        return 2;
+    }
+
+    MovieFile movie(&context);
+    int ret = movie.loadMovie();
+    if (ret < 0) {
+        std::cerr << MovieFile::errorString(ret) << std::endl;
+        return 2;
+    }
+    uint64_t movie_frames = movie.nbFrames();
+
+    /* Instance K encodes into <dumpfile>_part<K>.ext. If its encode is split
+     * into several segments, the following ones are written into
+     * <dumpfile>_part<K>_1.ext, <dumpfile>_part<K>_2.ext, etc. */
+    const std::string& dumpfile = context.config.dumpfile;
+    size_t dot = dumpfile.find_last_of('.');
+    if ((dot == std::string::npos) || (dot < dumpfile.find_last_of('/'))) {
+        std::cerr << "The encode file must have an extension" << std::endl;
+        return 2;
+    }
+    std::string partbase = dumpfile.substr(0, dot) + "_part";
+    std::string ext = dumpfile.substr(dot);
+
+    /* Remove the segments of a previous split rendering, because the
+     * segments to concatenate are found by their existence */
+    for (int k = 0; k < split_count; k++) {
+        std::string instancebase = partbase + std::to_string(k);
+        if (unlink((instancebase + ext).c_str()) == 0) {
+            for (int segment = 1; unlink((instancebase + "_" + std::to_string(segment) + ext).c_str()) == 0; segment++);
+        }
+    }
+
+    struct timespec start_time, end_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    /* Socket names include our pid so that concurrent split renderings don't
+     * share them */
+    std::string socketbase = "/tmp/libTAS_split" + std::to_string(getpid()) + "_";
+
+    std::vector<pid_t> pids;
+    for (int k = 0; k < split_count; k++) {
+        uint64_t start_frame = movie_frames * k / split_count;
+        uint64_t end_frame = (k == split_count - 1) ? 0 : movie_frames * (k + 1) / split_count;
+        std::ostringstream part;
+        part << k << ":" << start_frame << ":" << end_frame;
+
+        std::vector<std::string> args = {binpath, "--headless", "--split-part", part.str(),
+            "-r", context.config.moviefile, "-d", partbase + std::to_string(k) + ext, context.gamepath};
+        if (!context.config.gameargs.empty())
+            args.push_back(context.config.gameargs);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            /* Each instance communicates with its game on its own socket */
+            std::string socketfile = socketbase + std::to_string(k) + ".socket";
+            setenv("LIBTAS_SOCKET", socketfile.c_str(), 1);
+
+            std::vector<char*> argv;
+            for (std::string& arg : args)
+                argv.push_back(const_cast<char*>(arg.c_str()));
+            argv.push_back(nullptr);
+            execv(argv[0], argv.data());
+            exit(2);
+        }
+        pids.push_back(pid);
+    }
+
+    int failed = 0;
+    for (pid_t pid : pids) {
+        int status;
+        if ((pid < 0) || (waitpid(pid, &status, 0) < 0) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+            failed++;
+    }
+    if (failed > 0) {
+        std::cerr << failed << " segment(s) could not be encoded" << std::endl;
+        return 1;
+    }
+
+    /* List the segments that were actually produced, in order */
+    std::vector<std::string> partfiles;
+    for (int k = 0; k < split_count; k++) {
+        std::string instancebase = partbase + std::to_string(k);
+        std::string partfile = instancebase + ext;
+        if (access(partfile.c_str(), F_OK) != 0) {
+            std::cerr << "Segment " << partfile << " was not produced" << std::endl;
+            return 1;
+        }
+        for (int segment = 1; access(partfile.c_str(), F_OK) == 0; segment++) {
+            partfiles.push_back(partfile);
+            partfile = instancebase + "_" + std::to_string(segment) + ext;
+        }
+    }
+
+    /* Concatenate the segments with the concat demuxer of ffmpeg */
+    std::string listfile = partbase + ".txt";
+    std::ofstream list(listfile);
+    for (const std::string& partfile : partfiles) {
+        /* Single quotes must be escaped in the list file */
+        std::string escaped;
+        for (char c : partfile) {
+            if (c == '\'')
+                escaped += "'\\''";
+            else
+                escaped += c;
+        }
+        list << "file '" << escaped << "'" << std::endl;
+    }
+    list.close();
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        execlp("ffmpeg", "ffmpeg", "-hide_banner", "-y", "-f", "concat", "-safe", "0",
+            "-i", listfile.c_str(), "-c", "copy", dumpfile.c_str(), nullptr);
+        exit(2);
+    }
+    int status;
+    if ((pid < 0) || (waitpid(pid, &status, 0) < 0) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+        std::cerr << "Could not concatenate the segments, they are kept in " << partbase << "*" << ext << std::endl;
+        return 1;
+    }
+
+    for (const std::string& partfile : partfiles)
+        unlink(partfile.c_str());
+    unlink(listfile.c_str());
+
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double total_sec = (end_time.tv_sec - start_time.tv_sec) +
+        (end_time.tv_nsec - start_time.tv_nsec) / 1000000000.0;
+    std::cout << "Encoded " << movie_frames << " frames in " << split_count << " segments in " << total_sec << " s" << std::endl;
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
 #ifdef LIBTAS_INTERIM_COMMIT
@@ -70,6 +284,8 @@ int main(int argc, char **argv)
     std::string moviefile;
     std::string dumpfile;
     int recordingmode = SharedConfig::RECORDING_WRITE;
+    int split_count = 0;
+    int split_part = -1;
 
     static struct option long_options[] =
     {
@@ -77,6 +293,9 @@ int main(int argc, char **argv)
         {"write", required_argument, nullptr, 'w'},
         {"dump", required_argument, nullptr, 'd'},
         {"non-interactive", no_argument, nullptr, 'n'},
+        {"headless", no_argument, nullptr, 'H'},
+        {"split", required_argument, nullptr, 'S'},
+        {"split-part", required_argument, nullptr, 'P'},
         {"help", no_argument, nullptr, 'h'},
         {nullptr, 0, nullptr, 0}
     };
@@ -104,6 +323,28 @@ int main(int argc, char **argv)
             case 'n':
                 context.interactive = false;
                 break;
+            case 'H':
+                context.interactive = false;
+                context.headless = true;
+                break;
+            case 'S':
+                /* Split rendering into a number of segments */
+                split_count = atoi(optarg);
+                context.interactive = false;
+                context.headless = true;
+                break;
+            case 'P':
+            {
+                /* Segment of a split rendering, as segment:start:end */
+                unsigned long long start_frame, end_frame;
+                if (sscanf(optarg, "%d:%llu:%llu", &split_part, &start_frame, &end_frame) != 3) {
+                    std::cerr << "Invalid split part " << optarg << std::endl;
+                    return -1;
+                }
+                context.encode_start_frame = start_frame;
+                context.encode_end_frame = end_frame;
+                break;
+            }
             case '?':
                 std::cout << "Unknown option character" << std::endl;
                 break;
@@ -262,6 +503,15 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    /* Instances of a split rendering extract the movie in separate dirs */
+    if (split_part >= 0) {
+        context.config.tempmoviedir += "/split" + std::to_string(split_part);
+        if (create_dir(context.config.tempmoviedir) < 0) {
+            std::cerr << "Cannot create dir " << context.config.tempmoviedir << std::endl;
+            return -1;
+        }
+    }
+
     if (context.config.savestatedir.empty()) {
         context.config.savestatedir = data_dir + "/states";
     }
@@ -289,6 +539,20 @@ int main(int argc, char **argv)
         close(fd);
     }
 
+    if (context.headless) {
+        int ret;
+        if ((split_count > 1) && (split_part < 0))
+            ret = runSplitHeadless(split_count, binpath);
+        else
+            ret = runHeadless();
+
+        xcb_free_cursor (context.conn, context.crosshair_cursor);
+        xcb_cursor_context_free(ctx);
+
+        xcb_disconnect(context.conn);
+        return ret;
+    }
+
     /* Starts the user interface */
     QApplication app(argc, argv);
 
@@ -309,6 +573,7 @@ int main(int argc, char **argv)
             context.config.sc.running = true;
             context.config.sc_modified = true;
         }
+        context.hotkey_pressed_queue.notify();
 
         struct timespec tim = {0, 10000000L};
         for (int i=0; i<20; i++) {
@@ -0,0 +1,130 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CompareKernels.h"
+#include "RamWatch.h"
+#include <cstring>
+
+/* Comparisons returning if a value must be removed, mirroring CHECK_TYPED */
+struct RemoveIfNotEqual { template <typename T> bool operator()(T a, T b) const { return a != b; } };
+struct RemoveIfEqual { template <typename T> bool operator()(T a, T b) const { return a == b; } };
+struct RemoveIfNotLess { template <typename T> bool operator()(T a, T b) const { return a >= b; } };
+struct RemoveIfNotGreater { template <typename T> bool operator()(T a, T b) const { return a <= b; } };
+struct RemoveIfNotLessEqual { template <typename T> bool operator()(T a, T b) const { return a > b; } };
+struct RemoveIfNotGreaterEqual { template <typename T> bool operator()(T a, T b) const { return a < b; } };
+
+/* Pack 8 bytes containing 0 or 1 into 8 bits */
+static inline uint64_t packBytes(uint64_t bytes)
+{
+    return (bytes * 0x0102040810204080ull) >> 56;
+}
+
+/* Get the mask of the 64 values to keep. The loops only work on byte
+ * arrays so that the compiler can vectorize them. */
+template <typename T, typename Remove, bool WithPrevious>
+static inline __attribute__((always_inline)) uint64_t keepMask(const uint8_t* values, const uint8_t* previous, T constant)
+{
+    uint8_t removed[64];
+    for (int i = 0; i < 64; i++) {
+        T value, ref;
+        memcpy(&value, values + i * sizeof(T), sizeof(T));
+        if (WithPrevious)
+            memcpy(&ref, previous + i * sizeof(T), sizeof(T));
+        else
+            ref = constant;
+        /* NaN values are always removed (this is a no-op for integers) */
+        removed[i] = (value != value) | Remove()(value, ref);
+    }
+
+    uint64_t mask = 0;
+    for (int i = 0; i < 8; i++) {
+        uint64_t bytes;
+        memcpy(&bytes, removed + 8 * i, 8);
+        mask |= packBytes(bytes) << (8 * i);
+    }
+    return ~mask;
+}
+
+template <typename T, typename Remove, bool WithPrevious>
+static inline __attribute__((always_inline)) void compareLoop(const uint8_t* values, const uint8_t* previous, size_t count, T constant, uint64_t* bitmap)
+{
+    for (size_t w = 0; w < count / 64; w++) {
+        if (!bitmap[w])
+            continue;
+        size_t offset = w * 64 * sizeof(T);
+        bitmap[w] &= keepMask<T, Remove, WithPrevious>(values + offset, previous + offset, constant);
+    }
+}
+
+template <typename T, typename Remove>
+static inline __attribute__((always_inline)) void compareWithType(const uint8_t* values, const uint8_t* previous, size_t count, CompareType compare_type, double compare_value, uint64_t* bitmap)
+{
+    if (compare_type == CompareType::Previous)
+        compareLoop<T, Remove, true>(values, previous, count, T(), bitmap);
+    else
+        compareLoop<T, Remove, false>(values, previous, count, static_cast<T>(compare_value), bitmap);
+}
+
+template <typename T>
+static inline __attribute__((always_inline)) void compareTyped(const uint8_t* values, const uint8_t* previous, size_t count, CompareType compare_type, CompareOperator compare_operator, double compare_value, uint64_t* bitmap)
+{
+    switch (compare_operator) {
+        case CompareOperator::Equal:
+            return compareWithType<T, RemoveIfNotEqual>(values, previous, count, compare_type, compare_value, bitmap);
+        case CompareOperator::NotEqual:
+            return compareWithType<T, RemoveIfEqual>(values, previous, count, compare_type, compare_value, bitmap);
+        case CompareOperator::Less:
+            return compareWithType<T, RemoveIfNotLess>(values, previous, count, compare_type, compare_value, bitmap);
+        case CompareOperator::Greater:
+            return compareWithType<T, RemoveIfNotGreater>(values, previous, count, compare_type, compare_value, bitmap);
+        case CompareOperator::LessEqual:
+            return compareWithType<T, RemoveIfNotLessEqual>(values, previous, count, compare_type, compare_value, bitmap);
+        case CompareOperator::GreaterEqual:
+            return compareWithType<T, RemoveIfNotGreaterEqual>(values, previous, count, compare_type, compare_value, bitmap);
+    }
+}
+
+__attribute__((target_clones("arch=skylake-avx512", "avx2", "default")))
+void compareKernel(const uint8_t* values, const uint8_t* previous, size_t count,
+    CompareType compare_type, CompareOperator compare_operator,
+    double compare_value, uint64_t* bitmap)
+{
+    switch (RamWatch::type) {
+        case RamWatch::RamChar:
+            return compareTyped<int8_t>(values, previous, count, compare_type, compare_operator, compare_value, bitmap);
+        case RamWatch::RamUnsignedChar:
+            return compareTyped<uint8_t>(values, previous, count, compare_type, compare_operator, compare_value, bitmap);
+        case RamWatch::RamShort:
+            return compareTyped<int16_t>(values, previous, count, compare_type, compare_operator, compare_value, bitmap);
+        case RamWatch::RamUnsignedShort:
+            return compareTyped<uint16_t>(values, previous, count, compare_type, compare_operator, compare_value, bitmap);
+        case RamWatch::RamInt:
+            return compareTyped<int32_t>(values, previous, count, compare_type, compare_operator, compare_value, bitmap);
+        case RamWatch::RamUnsignedInt:
+            return compareTyped<uint32_t>(values, previous, count, compare_type, compare_operator, compare_value, bitmap);
+        case RamWatch::RamLong:
+            return compareTyped<int64_t>(values, previous, count, compare_type, compare_operator, compare_value, bitmap);
+        case RamWatch::RamUnsignedLong:
+            return compareTyped<uint64_t>(values, previous, count, compare_type, compare_operator, compare_value, bitmap);
+        case RamWatch::RamFloat:
+            return compareTyped<float>(values, previous, count, compare_type, compare_operator, compare_value, bitmap);
+        case RamWatch::RamDouble:
+            return compareTyped<double>(values, previous, count, compare_type, compare_operator, compare_value, bitmap);
+    }
+}
@@ -0,0 +1,42 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_COMPAREKERNELS_H_INCLUDED
+#define LIBTAS_COMPAREKERNELS_H_INCLUDED
+
+#include "CompareEnums.h"
+#include <cstdint>
+#include <cstddef>
+
+/* Filter a candidate bitmap by comparing a buffer of values of type
+ * RamWatch::type. Bit i of the bitmap corresponds to value i of the buffer,
+ * and is cleared if the value does not match the comparison, with the same
+ * semantic as RamWatch::check(). Values are compared against the values of
+ * `previous` if compare_type is CompareType::Previous, or against
+ * compare_value otherwise. Bitmap words that are zero are skipped.
+ * `count` must be a multiple of 64.
+ *
+ * The kernels are compiled for several instruction sets (AVX-512, AVX2 and
+ * the default SSE2) and the best one is selected at runtime.
+ */
+void compareKernel(const uint8_t* values, const uint8_t* previous, size_t count,
+    CompareType compare_type, CompareOperator compare_operator,
+    double compare_value, uint64_t* bitmap);
+
+#endif
@@ -0,0 +1,195 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MemoryHistory.h"
+#include "SearchRegion.h"
+#include "../../external/lz4.h"
+#include <algorithm>
+#include <cstring>
+
+static const size_t PAGE_SIZE = 4096;
+
+void MemoryHistory::start(const std::vector<uintptr_t>& p)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    pages = p;
+    frames.clear();
+    last.clear();
+    last.shrink_to_fit();
+    last_valid.clear();
+    recording = true;
+}
+
+void MemoryHistory::stop()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    recording = false;
+    last.clear();
+    last.shrink_to_fit();
+}
+
+bool MemoryHistory::isRecording()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return recording;
+}
+
+size_t MemoryHistory::frameCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return frames.size();
+}
+
+size_t MemoryHistory::memorySize()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t size = 0;
+    for (const Frame& frame : frames)
+        size += frame.data.size() + frame.pages.size() * (sizeof(uint32_t) + sizeof(int));
+    return size;
+}
+
+void MemoryHistory::record(pid_t pid, uint64_t framecount)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!recording)
+        return;
+
+    /* Don't record the same frame twice in a row */
+    if (!frames.empty() && (frames.back().framecount == framecount))
+        return;
+
+    std::vector<uint8_t> current(pages.size() * PAGE_SIZE);
+    std::vector<bool> valid;
+    readProcessPages(pid, pages, current.data(), valid);
+
+    /* The first frame stores all pages */
+    bool first = last.empty();
+
+    Frame frame;
+    frame.framecount = framecount;
+    char compressed[LZ4_COMPRESSBOUND(PAGE_SIZE)];
+
+    for (uint32_t p = 0; p < pages.size(); p++) {
+        const uint8_t* page = current.data() + p * PAGE_SIZE;
+
+        if (!first && (valid[p] == last_valid[p]) &&
+            (!valid[p] || (memcmp(page, last.data() + p * PAGE_SIZE, PAGE_SIZE) == 0)))
+            continue;
+
+        frame.pages.push_back(p);
+        if (!valid[p]) {
+            frame.sizes.push_back(-1);
+            continue;
+        }
+
+        int size = LZ4_compress_default(reinterpret_cast<const char*>(page), compressed, PAGE_SIZE, sizeof(compressed));
+        frame.sizes.push_back(size);
+        frame.data.insert(frame.data.end(), compressed, compressed + size);
+    }
+
+    frames.push_back(std::move(frame));
+    last.swap(current);
+    last_valid.swap(valid);
+}
+
+void MemoryHistory::query(std::vector<RamWatch>& watches, CompareType compare_type,
+    CompareOperator compare_operator, double compare_value,
+    QueryMode mode, int n)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    /* Locate each watch in the recorded pages */
+    std::vector<int> watch_pages(watches.size());
+    for (size_t w = 0; w < watches.size(); w++) {
+        uintptr_t page = watches[w].address & ~static_cast<uintptr_t>(PAGE_SIZE - 1);
+        auto it = std::lower_bound(pages.begin(), pages.end(), page);
+        watch_pages[w] = ((it != pages.end()) && (*it == page)) ? (it - pages.begin()) : -1;
+    }
+
+    /* Matching state of each watch */
+    std::vector<int> match_count(watches.size(), 0);
+    std::vector<int> run(watches.size(), 0);
+    std::vector<int> best_run(watches.size(), 0);
+    std::vector<bool> removed(watches.size(), false);
+
+    /* Content of the pages at the current frame */
+    std::vector<uint8_t> state(pages.size() * PAGE_SIZE);
+    std::vector<bool> state_valid(pages.size(), false);
+
+    for (size_t f = 0; f < frames.size(); f++) {
+        const Frame& frame = frames[f];
+
+        /* Apply the changed pages */
+        const char* data = frame.data.data();
+        for (size_t i = 0; i < frame.pages.size(); i++) {
+            uint32_t p = frame.pages[i];
+            int size = frame.sizes[i];
+            if (size < 0) {
+                state_valid[p] = false;
+                continue;
+            }
+            state_valid[p] = (LZ4_decompress_safe(data, reinterpret_cast<char*>(state.data() + p * PAGE_SIZE), size, PAGE_SIZE) == static_cast<int>(PAGE_SIZE));
+            data += size;
+        }
+
+        for (size_t w = 0; w < watches.size(); w++) {
+            if (removed[w])
+                continue;
+
+            int p = watch_pages[w];
+            if ((p < 0) || !state_valid[p]) {
+                removed[w] = true;
+                continue;
+            }
+
+            RamWatch &watch = watches[w];
+            uint64_t value = 0;
+            memcpy(&value, state.data() + p * PAGE_SIZE + (watch.address - pages[p]), RamWatch::type_size);
+
+            /* There is nothing to compare to on the first frame */
+            if ((f > 0) || (compare_type == CompareType::Value)) {
+                if (watch.check(value, compare_type, compare_operator, compare_value)) {
+                    run[w] = 0;
+                    if (mode == QueryAll)
+                        removed[w] = true;
+                }
+                else {
+                    match_count[w]++;
+                    run[w]++;
+                    best_run[w] = std::max(best_run[w], run[w]);
+                }
+            }
+
+            watch.previous_value = value;
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t w = 0; w < watches.size(); w++) {
+        if (removed[w])
+            continue;
+        if ((mode == QueryAtLeast) && (match_count[w] < n))
+            continue;
+        if ((mode == QueryRun) && (best_run[w] < n))
+            continue;
+        watches[kept++] = watches[w];
+    }
+    watches.erase(watches.begin() + kept, watches.end());
+}
@@ -0,0 +1,97 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_MEMORYHISTORY_H_INCLUDED
+#define LIBTAS_MEMORYHISTORY_H_INCLUDED
+
+#include "CompareEnums.h"
+#include "RamWatch.h"
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <sys/types.h>
+
+/* Record the content of a set of memory pages at each frame, to search for
+ * values based on how they evolve over many frames. Only the pages that
+ * changed since the previous frame are stored, compressed with LZ4.
+ */
+class MemoryHistory {
+public:
+    enum QueryMode {
+        QueryAll, // Comparison matches on all frames
+        QueryAtLeast, // Comparison matches on at least n frames
+        QueryRun, // Comparison matches on at least n consecutive frames
+    };
+
+    /* Start a new recording of the given pages, sorted by address */
+    void start(const std::vector<uintptr_t>& pages);
+
+    /* Stop the recording, keeping the recorded frames */
+    void stop();
+
+    bool isRecording();
+
+    /* Number of recorded frames */
+    size_t frameCount();
+
+    /* Memory used by the recorded frames */
+    size_t memorySize();
+
+    /* Capture the recorded pages from the game. Called at each frame
+     * boundary from the game loop thread. */
+    void record(pid_t pid, uint64_t framecount);
+
+    /* Only keep the watches whose value matches the comparison over the
+     * recorded frames, according to `mode`. With CompareType::Previous,
+     * each frame is compared with the frame before. Watches are updated
+     * with their value at the last recorded frame. The history is
+     * decompressed in a single pass. */
+    void query(std::vector<RamWatch>& watches, CompareType compare_type,
+        CompareOperator compare_operator, double compare_value,
+        QueryMode mode, int n);
+
+private:
+    struct Frame {
+        uint64_t framecount;
+
+        /* Index of the pages that changed */
+        std::vector<uint32_t> pages;
+
+        /* Compressed size of each changed page, or -1 if the page could not
+         * be read */
+        std::vector<int> sizes;
+
+        /* Compressed page contents */
+        std::vector<char> data;
+    };
+
+    std::mutex mutex;
+    bool recording = false;
+
+    /* Recorded pages */
+    std::vector<uintptr_t> pages;
+
+    /* Page contents at the last recorded frame */
+    std::vector<uint8_t> last;
+    std::vector<bool> last_valid;
+
+    std::vector<Frame> frames;
+};
+
+#endif
@@ -0,0 +1,121 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_PARALLELSCAN_H_INCLUDED
+#define LIBTAS_PARALLELSCAN_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Run `task(i)` for each i in [0, count) on all available cores. Tasks are
+ * independent (typically one per memory region), and each thread takes the
+ * next pending task when it is done with its own, so that a few large
+ * regions don't keep the other threads idle. Tasks must write their results
+ * at their own index, so that the merged results don't depend on scheduling.
+ *
+ * While waiting, the calling thread calls `progress()` regularly, so that
+ * Qt signals are still emitted from the UI thread. If `progress()` returns
+ * false, the scan is cancelled: no new task is started, and the function
+ * returns false once the running tasks are done. An exception thrown by
+ * a task is rethrown here once all threads are done.
+ */
+template <typename Task, typename Progress>
+bool parallelScan(size_t count, Task task, Progress progress)
+{
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::atomic<bool> cancelled(false);
+    std::exception_ptr error;
+
+    std::mutex mutex;
+    std::condition_variable done_cond;
+    unsigned int running = 0;
+
+    auto worker = [&]() {
+        size_t i;
+        while (!failed && !cancelled && ((i = next++) < count)) {
+            try {
+                task(i);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!failed)
+                    error = std::current_exception();
+                failed = true;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        running--;
+        done_cond.notify_one();
+    };
+
+    unsigned int thread_count = std::thread::hardware_concurrency();
+    if (thread_count == 0)
+        thread_count = 1;
+    if (thread_count > count)
+        thread_count = count;
+
+    /* Join the started threads even if starting another one throws */
+    struct ThreadJoiner {
+        std::vector<std::thread> threads;
+        ~ThreadJoiner() {
+            for (std::thread &thread : threads)
+                if (thread.joinable())
+                    thread.join();
+        }
+    } joiner;
+
+    running = thread_count;
+    try {
+        for (unsigned int t = 0; t < thread_count; t++)
+            joiner.threads.emplace_back(worker);
+    }
+    catch (...) {
+        /* Stop the started threads, which are joined by the guard */
+        failed = true;
+        throw;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (running > 0) {
+            done_cond.wait_for(lock, std::chrono::milliseconds(50));
+            lock.unlock();
+            if (!progress())
+                cancelled = true;
+            lock.lock();
+        }
+    }
+
+    for (std::thread &thread : joiner.threads)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+
+    return !cancelled;
+}
+
+#endif
@@ -19,6 +19,7 @@
 
 #include "RamWatch.h"
 #include "CompareEnums.h"
+#include "SaveStateFile.h"
 #include <cstdint>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -29,6 +30,7 @@
 
 bool RamWatch::isValid;
 pid_t RamWatch::game_pid;
+const SaveStateFile* RamWatch::savestate = nullptr;
 int RamWatch::type;
 int RamWatch::type_size;
 
@@ -161,8 +163,18 @@ const char* RamWatch::tostring(bool hex, uint64_t value) const
 
 uint64_t RamWatch::get_value() const
 {
-    struct iovec local, remote;
     uint64_t value = 0;
+
+    if (savestate) {
+        /* Values are aligned, so they don't cross a page boundary */
+        uint8_t page[4096];
+        isValid = savestate->readPage(address & ~static_cast<uintptr_t>(4095), page);
+        if (isValid)
+            memcpy(&value, page + (address & 4095), type_size);
+        return value;
+    }
+
+    struct iovec local, remote;
     local.iov_base = static_cast<void*>(&value);
     local.iov_len = type_size;
     remote.iov_base = reinterpret_cast<void*>(address);
@@ -24,6 +24,8 @@
 #include <cstdint>
 #include <sys/types.h>
 
+class SaveStateFile;
+
 class RamWatch {
 public:
     uintptr_t address;
@@ -31,6 +33,11 @@ public:
 
     static bool isValid;
     static pid_t game_pid;
+
+    /* Savestate to read the memory from instead of the game process, or
+     * nullptr */
+    static const SaveStateFile* savestate;
+
     static int type;
     static int type_size;
 
@@ -0,0 +1,194 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SaveStateFile.h"
+#include "../../library/checkpoint/StateHeader.h"
+#include "../../external/lz4.h"
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static const size_t PAGE_SIZE = 4096;
+
+SaveStateFile::SaveStateFile(const std::string& path, const std::string& basepath) : pfd(-1)
+{
+    std::ifstream pmfile(path + ".pm", std::ios::binary);
+    if (!pmfile)
+        return;
+
+    /* Read the whole pagemap file, which only stores one byte per page */
+    std::vector<char> pagemap((std::istreambuf_iterator<char>(pmfile)), std::istreambuf_iterator<char>());
+
+    size_t pos = sizeof(libtas::StateHeader);
+    while (pos + sizeof(libtas::Area) <= pagemap.size()) {
+        SavedArea sa;
+        memcpy(&sa.area, pagemap.data() + pos, sizeof(libtas::Area));
+        pos += sizeof(libtas::Area);
+
+        /* Last area */
+        if (sa.area.addr == nullptr)
+            break;
+
+        if (!sa.area.skip) {
+            size_t page_count = sa.area.size / PAGE_SIZE;
+            if (pos + page_count > pagemap.size())
+                break;
+            sa.flags.assign(pagemap.data() + pos, pagemap.data() + pos + page_count);
+            pos += page_count;
+        }
+
+        sa.offsets_flag.reset(new std::once_flag);
+        areas.push_back(std::move(sa));
+    }
+
+    pfd = open((path + ".p").c_str(), O_RDONLY);
+    if (pfd == -1) {
+        areas.clear();
+        return;
+    }
+
+    if (!basepath.empty()) {
+        base.reset(new SaveStateFile(basepath, ""));
+        if (!*base)
+            base.reset();
+    }
+}
+
+SaveStateFile::~SaveStateFile()
+{
+    if (pfd != -1)
+        close(pfd);
+}
+
+std::string SaveStateFile::slotPath(const std::string& savestatedir, const std::string& gamename, int slot)
+{
+    return savestatedir + '/' + gamename + ".state" + std::to_string(slot);
+}
+
+std::vector<MemSection> SaveStateFile::getSections() const
+{
+    std::vector<MemSection> sections;
+    MemSection::reset();
+
+    for (const SavedArea& sa : areas) {
+        const libtas::Area& area = sa.area;
+        if (area.skip)
+            continue;
+
+        /* Build the corresponding line of /proc/pid/maps, so that the
+         * section type is detected the same way */
+        std::ostringstream oss;
+        oss << std::hex << reinterpret_cast<uintptr_t>(area.addr) << '-' << reinterpret_cast<uintptr_t>(area.endAddr) << ' ';
+        oss << ((area.prot & PROT_READ) ? 'r' : '-');
+        oss << ((area.prot & PROT_WRITE) ? 'w' : '-');
+        oss << ((area.prot & PROT_EXEC) ? 'x' : '-');
+        oss << ((area.flags & MAP_SHARED) ? 's' : 'p') << ' ';
+        oss << area.offset << ' ' << area.devmajor << ':' << area.devminor << ' ';
+        oss << area.inodenum << ' ' << area.name;
+
+        std::string line = oss.str();
+        MemSection section;
+        section.readMap(line);
+        sections.push_back(section);
+    }
+
+    return sections;
+}
+
+const SaveStateFile::SavedArea* SaveStateFile::findArea(uintptr_t addr) const
+{
+    auto it = std::upper_bound(areas.begin(), areas.end(), addr,
+        [] (uintptr_t a, const SavedArea& sa) {
+            return a < reinterpret_cast<uintptr_t>(sa.area.addr);
+        });
+
+    if (it == areas.begin())
+        return nullptr;
+    --it;
+    if (addr >= reinterpret_cast<uintptr_t>(it->area.endAddr))
+        return nullptr;
+    return &(*it);
+}
+
+void SaveStateFile::computeOffsets(const SavedArea& sa) const
+{
+    std::vector<off_t>& offsets = sa.offsets;
+    offsets.assign(sa.flags.size(), -1);
+
+    off_t offset = sa.area.page_offset;
+    for (size_t i = 0; i < sa.flags.size(); i++) {
+        if (sa.flags[i] == libtas::Area::FULL_PAGE) {
+            offsets[i] = offset;
+            offset += PAGE_SIZE;
+        }
+        else if (sa.flags[i] == libtas::Area::COMPRESSED_PAGE) {
+            int compressed_length;
+            if (pread(pfd, &compressed_length, sizeof(int), offset) != sizeof(int))
+                return;
+            offsets[i] = offset;
+            offset += sizeof(int) + compressed_length;
+        }
+    }
+}
+
+bool SaveStateFile::readPage(uintptr_t addr, uint8_t* buffer) const
+{
+    const SavedArea* sa = findArea(addr);
+    if (!sa || sa->area.skip)
+        return false;
+
+    size_t i = (addr - reinterpret_cast<uintptr_t>(sa->area.addr)) / PAGE_SIZE;
+
+    switch (sa->flags[i]) {
+        case libtas::Area::NO_PAGE:
+        case libtas::Area::ZERO_PAGE:
+            memset(buffer, 0, PAGE_SIZE);
+            return true;
+        case libtas::Area::BASE_PAGE:
+            return base && base->readPage(addr, buffer);
+        case libtas::Area::FULL_PAGE:
+        case libtas::Area::COMPRESSED_PAGE:
+            break;
+        default:
+            return false;
+    }
+
+    std::call_once(*sa->offsets_flag, &SaveStateFile::computeOffsets, this, std::cref(*sa));
+    off_t offset = sa->offsets[i];
+    if (offset == -1)
+        return false;
+
+    if (sa->flags[i] == libtas::Area::FULL_PAGE)
+        return pread(pfd, buffer, PAGE_SIZE, offset) == static_cast<ssize_t>(PAGE_SIZE);
+
+    int compressed_length;
+    char compressed[LZ4_COMPRESSBOUND(PAGE_SIZE)];
+    if (pread(pfd, &compressed_length, sizeof(int), offset) != sizeof(int))
+        return false;
+    if ((compressed_length <= 0) || (compressed_length > static_cast<int>(sizeof(compressed))))
+        return false;
+    if (pread(pfd, compressed, compressed_length, offset + sizeof(int)) != compressed_length)
+        return false;
+    return LZ4_decompress_safe(compressed, reinterpret_cast<char*>(buffer), compressed_length, PAGE_SIZE) == static_cast<int>(PAGE_SIZE);
+}
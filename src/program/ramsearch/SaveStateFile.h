@@ -0,0 +1,89 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SAVESTATEFILE_H_INCLUDED
+#define LIBTAS_SAVESTATEFILE_H_INCLUDED
+
+#include "MemSection.h"
+#include "../../library/checkpoint/ProcMapsArea.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+/* Read access to the memory stored in a savestate file, so that RAM search
+ * and pointer scan can run on a savestate without loading it. Only the page
+ * flags are read when opening, and pages are read and decompressed when
+ * requested. Savestates stored in RAM cannot be accessed this way, and the
+ * game must have the same architecture as the program.
+ */
+class SaveStateFile {
+public:
+    /* Open the savestate at `path` (without the .pm/.p extension). Pages
+     * that were not modified since the base savestate are read from the
+     * savestate at `basepath`, which can be empty. */
+    SaveStateFile(const std::string& path, const std::string& basepath);
+    ~SaveStateFile();
+
+    /* Get the path of a savestate slot, slot 0 being the base savestate */
+    static std::string slotPath(const std::string& savestatedir, const std::string& gamename, int slot);
+
+    explicit operator bool() const {
+        return (pfd != -1);
+    }
+
+    /* Get the memory sections stored in the savestate, with the same type
+     * detection as for the /proc/pid/maps file */
+    std::vector<MemSection> getSections() const;
+
+    /* Read the page at a page-aligned address into `buffer`. Returns false
+     * if the page is not stored in the savestate. Can be called from
+     * multiple threads. */
+    bool readPage(uintptr_t addr, uint8_t* buffer) const;
+
+private:
+    struct SavedArea {
+        libtas::Area area;
+
+        /* Flag of each page */
+        std::vector<char> flags;
+
+        /* Offset of each stored page in the pages file, computed on first
+         * access because compressed pages have a variable size */
+        mutable std::vector<off_t> offsets;
+        std::unique_ptr<std::once_flag> offsets_flag;
+    };
+
+    /* Saved areas, sorted by address */
+    std::vector<SavedArea> areas;
+
+    /* Pages file */
+    int pfd;
+
+    /* Base savestate */
+    std::unique_ptr<SaveStateFile> base;
+
+    /* Get the area containing an address, or nullptr */
+    const SavedArea* findArea(uintptr_t addr) const;
+
+    void computeOffsets(const SavedArea& sa) const;
+};
+
+#endif
@@ -0,0 +1,233 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SearchRegion.h"
+#include "CompareKernels.h"
+#include "SaveStateFile.h"
+#include <sys/uio.h>
+#include <cstring>
+#include <algorithm>
+
+static const size_t PAGE_SIZE = 4096;
+static const int MAX_IOV = 1024; // IOV_MAX
+static const size_t BLOCK_WORDS = 64;
+
+void readPages(pid_t pid, const std::vector<uintptr_t>& pages, uint8_t* buffer, std::vector<bool>& valid)
+{
+    if (RamWatch::savestate) {
+        int page_count = pages.size();
+        valid.assign(page_count, false);
+        for (int p = 0; p < page_count; p++)
+            valid[p] = RamWatch::savestate->readPage(pages[p], buffer + p * PAGE_SIZE);
+        return;
+    }
+
+    readProcessPages(pid, pages, buffer, valid);
+}
+
+void readProcessPages(pid_t pid, const std::vector<uintptr_t>& pages, uint8_t* buffer, std::vector<bool>& valid)
+{
+    int page_count = pages.size();
+    valid.assign(page_count, false);
+
+    struct iovec locals[MAX_IOV];
+    struct iovec remotes[MAX_IOV];
+
+    int p = 0;
+    while (p < page_count) {
+        int n = std::min(page_count - p, MAX_IOV);
+        for (int i = 0; i < n; i++) {
+            locals[i].iov_base = static_cast<void*>(buffer + (p + i) * PAGE_SIZE);
+            locals[i].iov_len = PAGE_SIZE;
+            remotes[i].iov_base = reinterpret_cast<void*>(pages[p + i]);
+            remotes[i].iov_len = PAGE_SIZE;
+        }
+
+        /* The call stops at the first page that cannot be read, so we skip
+         * it and continue with the next ones. */
+        ssize_t ret = process_vm_readv(pid, locals, n, remotes, n, 0);
+        int read_pages = (ret > 0) ? (ret / PAGE_SIZE) : 0;
+        for (int i = 0; i < read_pages; i++)
+            valid[p + i] = true;
+        p += read_pages;
+        if (read_pages < n)
+            p++;
+    }
+}
+
+void SearchRegion::snapshot(pid_t pid)
+{
+    size_t value_count = size / RamWatch::type_size;
+    previous.resize(size);
+    bitmap.assign((value_count + 63) / 64, 0);
+
+    /* Read the region directly into the snapshot, in batches of pages */
+    size_t page_count = size / PAGE_SIZE;
+    std::vector<uintptr_t> pages;
+    std::vector<bool> valid;
+    for (size_t first = 0; first < page_count; first += MAX_IOV) {
+        size_t n = std::min(page_count - first, static_cast<size_t>(MAX_IOV));
+        pages.resize(n);
+        for (size_t i = 0; i < n; i++)
+            pages[i] = addr + (first + i) * PAGE_SIZE;
+
+        readPages(pid, pages, previous.data() + first * PAGE_SIZE, valid);
+
+        /* Set the candidate bits of readable pages */
+        size_t values_per_page = PAGE_SIZE / RamWatch::type_size;
+        for (size_t i = 0; i < n; i++) {
+            if (!valid[i])
+                continue;
+            size_t v = (first + i) * values_per_page;
+            size_t end = v + values_per_page;
+            /* Pages always cover whole bitmap words */
+            for (; v < end; v += 64)
+                bitmap[v / 64] = ~0ull;
+        }
+    }
+
+    updateCounts();
+}
+
+void SearchRegion::filter(CompareType compare_type, CompareOperator compare_operator, double compare_value)
+{
+    compareKernel(previous.data(), previous.data(), bitmap.size() * 64,
+        compare_type, compare_operator, compare_value, bitmap.data());
+
+    updateCounts();
+}
+
+void SearchRegion::search(pid_t pid, CompareType compare_type, CompareOperator compare_operator, double compare_value)
+{
+    size_t values_per_page = PAGE_SIZE / RamWatch::type_size;
+    size_t words_per_page = values_per_page / 64;
+    size_t page_count = size / PAGE_SIZE;
+
+    std::vector<uint8_t> buffer(MAX_IOV * PAGE_SIZE);
+    std::vector<uintptr_t> pages;
+    std::vector<size_t> page_indices;
+    std::vector<bool> valid;
+
+    size_t page = 0;
+    while (page < page_count) {
+        /* Gather the next batch of pages containing candidates */
+        pages.clear();
+        page_indices.clear();
+        for (; (page < page_count) && (pages.size() < MAX_IOV); page++) {
+            const uint64_t* words = bitmap.data() + page * words_per_page;
+            if (std::any_of(words, words + words_per_page, [](uint64_t word){return word != 0;})) {
+                pages.push_back(addr + page * PAGE_SIZE);
+                page_indices.push_back(page);
+            }
+        }
+
+        if (pages.empty())
+            break;
+
+        readPages(pid, pages, buffer.data(), valid);
+
+        for (size_t i = 0; i < pages.size(); i++) {
+            size_t p = page_indices[i];
+            uint64_t* words = bitmap.data() + p * words_per_page;
+
+            /* Unreadable pages lose all their candidates */
+            if (!valid[i]) {
+                std::fill(words, words + words_per_page, 0);
+                continue;
+            }
+
+            const uint8_t* cur_page = buffer.data() + i * PAGE_SIZE;
+            uint8_t* prev_page = previous.data() + p * PAGE_SIZE;
+
+            compareKernel(cur_page, prev_page, values_per_page,
+                compare_type, compare_operator, compare_value, words);
+
+            memcpy(prev_page, cur_page, PAGE_SIZE);
+        }
+    }
+
+    updateCounts();
+}
+
+void SearchRegion::updateCounts()
+{
+    block_counts.resize((bitmap.size() + BLOCK_WORDS - 1) / BLOCK_WORDS);
+    count = 0;
+    for (size_t w = 0; w < bitmap.size(); w++) {
+        if (!(w % BLOCK_WORDS))
+            block_counts[w / BLOCK_WORDS] = count;
+        count += __builtin_popcountll(bitmap[w]);
+    }
+}
+
+RamWatch SearchRegion::watchAt(size_t n) const
+{
+    /* Find the block containing the n-th candidate */
+    size_t block = std::upper_bound(block_counts.begin(), block_counts.end(), n) - block_counts.begin() - 1;
+    n -= block_counts[block];
+
+    /* Find the word, then the bit */
+    size_t w = block * BLOCK_WORDS;
+    for (; w < bitmap.size(); w++) {
+        size_t c = __builtin_popcountll(bitmap[w]);
+        if (n < c)
+            break;
+        n -= c;
+    }
+
+    uint64_t bits = bitmap[w];
+    for (; n > 0; n--)
+        bits &= bits - 1;
+
+    size_t offset = (w * 64 + __builtin_ctzll(bits)) * RamWatch::type_size;
+    RamWatch watch(addr + offset);
+    watch.previous_value = 0;
+    memcpy(&watch.previous_value, previous.data() + offset, RamWatch::type_size);
+    return watch;
+}
+
+void SearchRegion::appendWatches(std::vector<RamWatch>& watches) const
+{
+    for (size_t w = 0; w < bitmap.size(); w++) {
+        uint64_t bits = bitmap[w];
+        while (bits) {
+            int b = __builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            size_t offset = (w * 64 + b) * RamWatch::type_size;
+            watches.emplace_back(addr + offset);
+            watches.back().previous_value = 0;
+            memcpy(&watches.back().previous_value, previous.data() + offset, RamWatch::type_size);
+        }
+    }
+}
+
+void SearchRegion::appendPages(std::vector<uintptr_t>& pages) const
+{
+    size_t words_per_page = PAGE_SIZE / RamWatch::type_size / 64;
+    for (size_t w = 0; w < bitmap.size(); w += words_per_page) {
+        if (std::any_of(bitmap.begin() + w, bitmap.begin() + w + words_per_page, [](uint64_t word){return word != 0;}))
+            pages.push_back(addr + (w / words_per_page) * PAGE_SIZE);
+    }
+}
+
+size_t SearchRegion::memorySize() const
+{
+    return previous.size() + bitmap.size() * sizeof(uint64_t) + block_counts.size() * sizeof(size_t);
+}
@@ -0,0 +1,93 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SEARCHREGION_H_INCLUDED
+#define LIBTAS_SEARCHREGION_H_INCLUDED
+
+#include "CompareEnums.h"
+#include "RamWatch.h"
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <sys/types.h>
+
+/* A memory region during a RAM search. Instead of storing one RamWatch per
+ * candidate address, we store the raw content of the whole region at the
+ * last search, and a bitmap of the remaining candidates with one bit per
+ * address aligned on the value size. This takes roughly the size of the
+ * scanned memory, and removing a candidate only clears a bit.
+ */
+class SearchRegion {
+public:
+    uintptr_t addr;
+    size_t size;
+
+    /* Raw memory content at the last search */
+    std::vector<uint8_t> previous;
+
+    /* Candidate bitmap */
+    std::vector<uint64_t> bitmap;
+
+    /* Number of candidates */
+    size_t count;
+
+    SearchRegion(uintptr_t a, size_t s) : addr(a), size(s), count(0) {}
+
+    /* Read the region content and set all readable values as candidates.
+     * Throws std::bad_alloc if there is not enough memory. */
+    void snapshot(pid_t pid);
+
+    /* Only keep the candidates whose value at the last search match the
+     * comparison. Used when starting a new search. */
+    void filter(CompareType compare_type, CompareOperator compare_operator, double compare_value);
+
+    /* Only keep the candidates whose current value match the comparison, and
+     * store the current values */
+    void search(pid_t pid, CompareType compare_type, CompareOperator compare_operator, double compare_value);
+
+    /* Get the watch of the n-th candidate of the region */
+    RamWatch watchAt(size_t n) const;
+
+    /* Append all candidates to a list of watches */
+    void appendWatches(std::vector<RamWatch>& watches) const;
+
+    /* Append the address of all pages containing a candidate */
+    void appendPages(std::vector<uintptr_t>& pages) const;
+
+    /* Memory used by the region */
+    size_t memorySize() const;
+
+private:
+    /* Number of candidates before each block of 64 bitmap words, used to
+     * quickly locate the n-th candidate */
+    std::vector<size_t> block_counts;
+
+    /* Recompute the candidate count and block counts */
+    void updateCounts();
+};
+
+/* Read pages of the game memory using as few process_vm_readv calls as
+ * possible, or from RamWatch::savestate if set. Page i is stored at
+ * buffer + i*4096, and valid[i] indicates if it could be read. */
+void readPages(pid_t pid, const std::vector<uintptr_t>& pages, uint8_t* buffer, std::vector<bool>& valid);
+
+/* Same as readPages(), but always read from the game process */
+void readProcessPages(pid_t pid, const std::vector<uintptr_t>& pages, uint8_t* buffer, std::vector<bool>& valid);
+
+#endif
@@ -74,6 +74,21 @@ EncodeWindow::EncodeWindow(Context* c, QWidget *parent, Qt::WindowFlags flags) :
     videoFramerate->setMaximum(1000000000);
 //    connect(videoFramerate, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged), this, &EncodeWindow::slotUpdate);
 
+    pixfmtChoice = new QComboBox();
+    pixfmtChoice->addItem("Native (converted by ffmpeg)", SharedConfig::ENCODE_PIXFMT_NATIVE);
+    pixfmtChoice->addItem("YUV 4:2:0 planar", SharedConfig::ENCODE_PIXFMT_YUV420P);
+    pixfmtChoice->addItem("NV12", SharedConfig::ENCODE_PIXFMT_NV12);
+
+    videoDownscale = new QSpinBox();
+    videoDownscale->setRange(1, 8);
+    videoDownscale->setPrefix("1/");
+
+    backendChoice = new QComboBox();
+    backendChoice->addItem("ffmpeg process", SharedConfig::ENCODE_BACKEND_PIPE);
+    backendChoice->addItem("libavcodec (in-process)", SharedConfig::ENCODE_BACKEND_LIBAV);
+    backendChoice->addItem("Lossless capture (.ltcap)", SharedConfig::ENCODE_BACKEND_CAPTURE);
+    connect(backendChoice, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged), this, &EncodeWindow::slotBackend);
+
     ffmpegOptions = new QLineEdit();
 
     QGroupBox *codecGroupBox = new QGroupBox(tr("Encode codec settings"));
@@ -94,6 +109,14 @@ EncodeWindow::EncodeWindow(Context* c, QWidget *parent, Qt::WindowFlags flags) :
     encodeCodecLayout->addWidget(new QLabel(tr("Video framerate:")), 3, 0);
     encodeCodecLayout->addWidget(videoFramerate, 3, 1, 1, 4);
 
+    encodeCodecLayout->addWidget(new QLabel(tr("Pixel format:")), 4, 0);
+    encodeCodecLayout->addWidget(pixfmtChoice, 4, 1);
+    encodeCodecLayout->addWidget(new QLabel(tr("Downscale:")), 4, 3);
+    encodeCodecLayout->addWidget(videoDownscale, 4, 4);
+
+    encodeCodecLayout->addWidget(new QLabel(tr("Encoder:")), 5, 0);
+    encodeCodecLayout->addWidget(backendChoice, 5, 1);
+
     encodeCodecLayout->setColumnMinimumWidth(2, 50);
     encodeCodecLayout->setColumnStretch(2, 1);
     codecGroupBox->setLayout(encodeCodecLayout);
@@ -139,6 +162,14 @@ void EncodeWindow::update_config()
     /* Set video framerate */
     videoFramerate->setValue(context->config.sc.video_framerate);
 
+    /* Set pixel conversion */
+    pixfmtChoice->setCurrentIndex(pixfmtChoice->findData(context->config.sc.video_pixfmt));
+    videoDownscale->setValue(context->config.sc.video_downscale);
+
+    /* Set encoder backend */
+    backendChoice->setCurrentIndex(backendChoice->findData(context->config.sc.encode_backend));
+    slotBackend();
+
     if (context->config.ffmpegoptions.empty()) {
         slotUpdate();
     }
@@ -150,6 +181,14 @@ void EncodeWindow::slotUpdate()
     ffmpegOptions->setText(options);
 }
 
+void EncodeWindow::slotBackend()
+{
+    /* Lossless captures store the exact pixels */
+    bool lossless = (backendChoice->currentData().toInt() == SharedConfig::ENCODE_BACKEND_CAPTURE);
+    pixfmtChoice->setEnabled(!lossless);
+    videoDownscale->setEnabled(!lossless);
+}
+
 void EncodeWindow::slotOk()
 {
     /* Fill encode filename */
@@ -166,6 +205,9 @@ void EncodeWindow::slotOk()
     context->config.ffmpegoptions = ffmpegOptions->text().toStdString();
 
     context->config.sc.video_framerate = videoFramerate->value();
+    context->config.sc.video_pixfmt = pixfmtChoice->currentData().toInt();
+    context->config.sc.video_downscale = videoDownscale->value();
+    context->config.sc.encode_backend = backendChoice->currentData().toInt();
 
     context->config.sc_modified = true;
 
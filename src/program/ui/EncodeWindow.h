@@ -48,10 +48,14 @@ private:
     QSpinBox *audioBitrate;
     QLineEdit *ffmpegOptions;
     QSpinBox *videoFramerate;
+    QComboBox *pixfmtChoice;
+    QSpinBox *videoDownscale;
+    QComboBox *backendChoice;
 
 private slots:
     void slotBrowseEncodePath();
     void slotUpdate();
+    void slotBackend();
     void slotOk();
 };
 
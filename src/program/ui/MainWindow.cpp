@@ -88,6 +88,7 @@ MainWindow::MainWindow(Context* c) : QMainWindow(), context(c)
     connect(gameLoop, &GameLoop::inputsEdited, inputEditorWindow->inputEditorView->inputEditorModel, &InputEditorModel::endEditInputs);
     connect(gameLoop, &GameLoop::isInputEditorVisible, inputEditorWindow, &InputEditorWindow::isWindowVisible, Qt::DirectConnection);
     connect(gameLoop, &GameLoop::getRamWatch, ramWatchWindow, &RamWatchWindow::slotGet, Qt::DirectConnection);
+    connect(gameLoop, &GameLoop::recordMemory, ramSearchWindow, &RamSearchWindow::recordHistory, Qt::DirectConnection);
     connect(gameLoop, &GameLoop::savestatePerformed, inputEditorWindow->inputEditorView->inputEditorModel, &InputEditorModel::registerSavestate);
     connect(gameLoop, &GameLoop::getTimeTrace, timeTraceWindow->timeTraceModel, &TimeTraceModel::addCall);
 
@@ -1318,6 +1319,8 @@ void MainWindow::slotStop()
 
     if (context->status == Context::ACTIVE) {
         context->status = Context::QUITTING;
+        /* Wake up the game thread if it is waiting for events */
+        context->hotkey_pressed_queue.notify();
         updateStatus();
         game_thread.detach();
     }
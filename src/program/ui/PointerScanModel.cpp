@@ -19,16 +19,120 @@
 
 #include "PointerScanModel.h"
 #include "../utils.h"
+#include "../ramsearch/ParallelScan.h"
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+#include <QCoreApplication>
+#include <cstring>
+#include <sys/uio.h>
+
+/* Index of the address ranges that pointers can point to, to quickly check
+ * if a value could be a pointer. Ranges are sorted and merged. Values are
+ * first checked against a bitmap of coarse buckets covering the ranges,
+ * which rejects most values, then with a branchless binary search. */
+class AddressRanges {
+public:
+    AddressRanges(const std::vector<MemSection>& sections)
+    {
+        for (const MemSection &ms : sections) {
+            /* If pointing to a static section, we can skip it */
+            if (ms.type & (MemSection::MemDataRW | MemSection::MemBSS))
+                continue;
+
+            if (!ends.empty() && (ms.addr <= ends.back())) {
+                ends.back() = std::max(ends.back(), ms.endaddr);
+            }
+            else {
+                starts.push_back(ms.addr);
+                ends.push_back(ms.endaddr);
+            }
+        }
+
+        if (starts.empty()) {
+            low = 0;
+            span = 0;
+            return;
+        }
+
+        low = starts.front();
+        span = ends.back() - low;
+
+        /* Use at most 2^20 buckets */
+        bucket_shift = 12;
+        while ((span >> bucket_shift) >= (1 << 20))
+            bucket_shift++;
+
+        buckets.assign(((span >> bucket_shift) / 64) + 1, 0);
+        for (size_t r = 0; r < starts.size(); r++) {
+            uintptr_t first = (starts[r] - low) >> bucket_shift;
+            uintptr_t last = (ends[r] - 1 - low) >> bucket_shift;
+            for (uintptr_t b = first; b <= last; b++)
+                buckets[b / 64] |= 1ull << (b % 64);
+        }
+    }
+
+    bool contains(uintptr_t value) const
+    {
+        uintptr_t offset = value - low;
+        if (offset >= span)
+            return false;
+
+        uintptr_t b = offset >> bucket_shift;
+        if (!(buckets[b / 64] & (1ull << (b % 64))))
+            return false;
+
+        /* Find the last range starting before the value */
+        const uintptr_t* base = starts.data();
+        size_t n = starts.size();
+        while (n > 1) {
+            size_t half = n / 2;
+            base = (base[half] <= value) ? base + half : base;
+            n -= half;
+        }
+        return value < ends[base - starts.data()];
+    }
+
+private:
+    std::vector<uintptr_t> starts;
+    std::vector<uintptr_t> ends;
+    uintptr_t low;
+    uintptr_t span;
+    int bucket_shift;
+    std::vector<uint64_t> buckets;
+};
 
 PointerScanModel::PointerScanModel(Context* c, QObject *parent) : QAbstractTableModel(parent), context(c) {}
 
-void PointerScanModel::locatePointers()
+bool PointerScanModel::setMemorySource(int slot)
 {
-    pointer_map.clear();
-    static_pointer_map.clear();
+    memory_slot = slot;
+    savestate.reset();
+
+    if (slot == 0)
+        return true;
+
+    savestate.reset(new SaveStateFile(
+        SaveStateFile::slotPath(context->config.savestatedir, context->gamename, slot),
+        SaveStateFile::slotPath(context->config.savestatedir, context->gamename, 0)));
+    if (!*savestate) {
+        savestate.reset();
+        return false;
+    }
+    return true;
+}
+
+bool PointerScanModel::getSections(std::vector<MemSection>& sections)
+{
+    sections.clear();
+
+    if (savestate) {
+        sections = savestate->getSections();
+        return true;
+    }
 
     /* Compose the filename for the /proc memory map, and open it. */
     std::ostringstream oss;
@@ -36,20 +140,35 @@ void PointerScanModel::locatePointers()
     std::ifstream mapsfile(oss.str());
     if (!mapsfile) {
         std::cerr << "Could not open " << oss.str() << std::endl;
-        return;
+        return false;
     }
 
     std::string line;
     MemSection::reset();
 
+    while (std::getline(mapsfile, line)) {
+        MemSection section;
+        section.readMap(line);
+        sections.push_back(section);
+    }
+
+    return true;
+}
+
+bool PointerScanModel::locatePointers()
+{
+    pointer_map.clear();
+    static_pointer_map.clear();
+
+    std::vector<MemSection> all_sections;
+    if (!getSections(all_sections))
+        return false;
+
     std::vector<MemSection> memory_sections;
     file_mapping_sections.clear();
 
     int total_size = 0;
-    while (std::getline(mapsfile, line)) {
-
-        MemSection section;
-        section.readMap(line);
+    for (const MemSection &section : all_sections) {
 
         /* Only store sections that could contain pointers */
         if (section.type & (MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemHeap | MemSection::MemAnonymousMappingRW | MemSection::MemFileMappingRW)) {
@@ -63,65 +182,102 @@ void PointerScanModel::locatePointers()
         }
     }
 
-    /* Read all memory and store all pointers */
-    int cur_size = 0;
-    for (const MemSection &section : memory_sections) {
+    /* Read all memory and store all pointers. Each section is scanned
+     * in parallel into its own lists, which are then merged in section
+     * order so that the maps are the same as a sequential scan. */
+    std::vector<std::vector<PointerEntry>> section_pointers(memory_sections.size());
+    std::atomic<int> cur_size(0);
+    AddressRanges ranges(memory_sections);
+
+    bool completed = parallelScan(memory_sections.size(), [this, &memory_sections, &section_pointers, &cur_size, &ranges] (size_t s) {
+        const MemSection &section = memory_sections[s];
+        std::vector<PointerEntry> &pointers = section_pointers[s];
 
         struct iovec local, remote;
         for (uintptr_t addr = section.addr; addr < section.endaddr; addr += 4096) {
 
+            cur_size += 4096;
+
             /* Read values in chunks of 4096 bytes so we lower the number
              * of `process_vm_readv` calls.
              */
             uintptr_t chunk[4096/sizeof(uintptr_t)];
-            local.iov_base = static_cast<void*>(chunk);
-            local.iov_len = 4096;
-            remote.iov_base = reinterpret_cast<void*>(addr);
-            remote.iov_len = 4096;
-
-            int readValues = process_vm_readv(context->game_pid, &local, 1, &remote, 1, 0);
-            if (readValues < 0) {
-                continue;
+            int readValues;
+            if (savestate) {
+                if (!savestate->readPage(addr, reinterpret_cast<uint8_t*>(chunk))) {
+                    continue;
+                }
+                readValues = 4096;
             }
-
-            for (unsigned int i = 0; i < readValues/sizeof(uintptr_t); i++, cur_size += sizeof(uintptr_t)) {
-
-                /* Update progress bar */
-                if (!(cur_size & 0xfff)) {
-                    emit signalProgress((int)(100 * ((float)cur_size / total_size)));
+            else {
+                local.iov_base = static_cast<void*>(chunk);
+                local.iov_len = 4096;
+                remote.iov_base = reinterpret_cast<void*>(addr);
+                remote.iov_len = 4096;
+
+                readValues = process_vm_readv(context->game_pid, &local, 1, &remote, 1, 0);
+                if (readValues < 0) {
+                    continue;
                 }
+            }
 
-                /* Check if the value could be a pointer */
-                bool isPointer = false;
-
-                for (const MemSection &ms : memory_sections) {
-                    /* If pointing to a static section, we can skip it */
-                    if (ms.type & (MemSection::MemDataRW | MemSection::MemBSS)) {
-                        continue;
-                    }
-
-                    /* We take advantage of the fact that sections are ordered */
-                    if (chunk[i] < ms.addr) {
-                        break;
-                    }
-                    if (chunk[i] < ms.endaddr) {
-                        isPointer = true;
-                        break;
-                    }
-                }
+            for (unsigned int i = 0; i < readValues/sizeof(uintptr_t); i++) {
 
-                if (isPointer) {
-                    uintptr_t stored_addr = addr + i*sizeof(uintptr_t);
-                    if (section.type & (MemSection::MemDataRW | MemSection::MemBSS)) {
-                        static_pointer_map.insert(std::make_pair(chunk[i], stored_addr));
-                    }
-                    else {
-                        pointer_map.insert(std::make_pair(chunk[i], stored_addr));
-                    }
+                /* Check if the value could be a pointer */
+                if (ranges.contains(chunk[i])) {
+                    pointers.push_back(std::make_pair(chunk[i], addr + i*sizeof(uintptr_t)));
                 }
             }
         }
+
+        std::sort(pointers.begin(), pointers.end());
+    }, [this, &cur_size, total_size] () {
+        /* Update progress bar, and let the user stop the search */
+        emit signalProgress((int)(100 * ((float)cur_size / total_size)));
+        QCoreApplication::processEvents();
+        return !stop_requested;
+    });
+
+    /* The pointer maps would be incomplete */
+    if (!completed)
+        return false;
+
+    std::vector<std::vector<PointerEntry>> static_lists;
+    std::vector<std::vector<PointerEntry>> dynamic_lists;
+    for (size_t s = 0; s < memory_sections.size(); s++) {
+        bool is_static = memory_sections[s].type & (MemSection::MemDataRW | MemSection::MemBSS);
+        (is_static ? static_lists : dynamic_lists).push_back(std::move(section_pointers[s]));
     }
+
+    mergeLists(static_lists, static_pointer_map);
+    mergeLists(dynamic_lists, pointer_map);
+    return true;
+}
+
+void PointerScanModel::mergeLists(std::vector<std::vector<PointerEntry>>& lists, std::vector<PointerEntry>& merged)
+{
+    /* Merge pairs of sorted lists in parallel until there is only one */
+    while (lists.size() > 1) {
+        std::vector<std::vector<PointerEntry>> next((lists.size() + 1) / 2);
+        parallelScan(next.size(), [&lists, &next] (size_t i) {
+            if (2*i + 1 == lists.size()) {
+                next[i].swap(lists[2*i]);
+                return;
+            }
+            std::vector<PointerEntry> &a = lists[2*i];
+            std::vector<PointerEntry> &b = lists[2*i + 1];
+            next[i].resize(a.size() + b.size());
+            std::merge(a.begin(), a.end(), b.begin(), b.end(), next[i].begin());
+            std::vector<PointerEntry>().swap(a);
+            std::vector<PointerEntry>().swap(b);
+        }, [] () { return true; });
+        lists.swap(next);
+    }
+
+    merged.clear();
+    if (!lists.empty())
+        merged.swap(lists[0]);
+    merged.shrink_to_fit();
 }
 
 std::string PointerScanModel::getFileAndOffset(uintptr_t& addr) const
@@ -136,56 +292,316 @@ std::string PointerScanModel::getFileAndOffset(uintptr_t& addr) const
     return std::string("");
 }
 
-void PointerScanModel::findPointerChain(uintptr_t addr, int ml, int max_offset)
+void PointerScanModel::findPointerChain(uintptr_t addr, int ml, int max_offset, int max_results)
 {
     static uint64_t last_scan_frame = 1 << 30;
-    /* Don't locate pointers again if this is the same frame */
-    if (last_scan_frame != context->framecount) {
-        locatePointers();
+    static int last_scan_slot = -1;
+    stop_requested = false;
+
+    /* Don't locate pointers again if this is the same frame. Savestates
+     * may have been overwritten, so they are always scanned again. */
+    if ((last_scan_frame != context->framecount) || (last_scan_slot != memory_slot) || savestate) {
+        if (!locatePointers()) {
+            /* The search was stopped, so the pointers must be located again */
+            pointer_map.clear();
+            static_pointer_map.clear();
+            last_scan_slot = -1;
+            return;
+        }
         last_scan_frame = context->framecount;
+        last_scan_slot = memory_slot;
     }
 
     beginResetModel();
-
     max_level = ml;
     pointer_chains.clear();
+    endResetModel();
+
+    this->max_results = max_results;
+    pending_chains.clear();
+
+    /* Build the graph of all addresses that can reach the target address,
+     * level by level. Each address is only expanded once, at its lowest
+     * level, and we store the edges to the addresses it points to. */
+    nodes.clear();
+    std::unordered_map<uintptr_t, int> node_index;
+    nodes.push_back({addr, 0, {}});
+    node_index.emplace(addr, 0);
+
+    size_t level_begin = 0;
+    size_t level_end = 1;
+    for (int depth = 0; (depth < (max_level-1)) && (level_begin < level_end); depth++) {
+        for (size_t n = level_begin; n < level_end; n++) {
+            uintptr_t node_addr = nodes[n].addr;
+            auto iter = std::lower_bound(pointer_map.begin(), pointer_map.end(), PointerEntry(node_addr - max_offset, 0));
+            for (; (iter != pointer_map.end()) && (iter->first <= node_addr); iter++) {
+                int m;
+                auto it = node_index.find(iter->second);
+                if (it == node_index.end()) {
+                    m = nodes.size();
+                    node_index.emplace(iter->second, m);
+                    nodes.push_back({iter->second, depth+1, {}});
+                }
+                else {
+                    m = it->second;
+                }
+                nodes[m].edges.push_back(std::make_pair(static_cast<int>(n), static_cast<int>(node_addr - iter->first)));
+            }
+
+            if (!(n & 0xfff)) {
+                emit signalProgress((int)(100 * (depth + (float)(n - level_begin) / (level_end - level_begin)) / max_level));
+                QCoreApplication::processEvents();
+                if (stop_requested) {
+                    nodes.clear();
+                    return;
+                }
+            }
+        }
+        level_begin = level_end;
+        level_end = nodes.size();
+    }
+
+    /* Enumerate the chains starting from a static pointer */
     int offsets[10];
+    for (size_t n = 0; n < nodes.size(); n++) {
+        uintptr_t node_addr = nodes[n].addr;
+        auto iter = std::lower_bound(static_pointer_map.begin(), static_pointer_map.end(), PointerEntry(node_addr - max_offset, 0));
+        for (; (iter != static_pointer_map.end()) && (iter->first <= node_addr); iter++) {
+            offsets[0] = node_addr - iter->first;
+            if (!enumerateChains(iter->second, n, 1, offsets))
+                break;
+        }
+
+        if (!(n & 0xfff)) {
+            emit signalProgress((int)(100 * (max_level - 1 + (float)n / nodes.size()) / max_level));
+            flushChains();
+            QCoreApplication::processEvents();
+        }
 
-    // std::cout << "max offset " << max_offset << std::endl;
+        if (stop_requested || (static_cast<int>(pointer_chains.size() + pending_chains.size()) >= max_results))
+            break;
+    }
 
-    recursiveFind(addr, 0, offsets, max_offset);
+    flushChains();
+    nodes.clear();
+}
 
-    endResetModel();
+bool PointerScanModel::enumerateChains(uintptr_t base_address, int n, int length, int offsets[])
+{
+    /* Reached the target. Offsets are stored in reverse order */
+    if (n == 0) {
+        std::vector<int> offset_vec(offsets, offsets + length);
+        std::reverse(offset_vec.begin(), offset_vec.end());
+        pending_chains.push_back(std::make_pair(base_address, offset_vec));
+        if (static_cast<int>(pointer_chains.size() + pending_chains.size()) >= max_results)
+            return false;
+        if (pending_chains.size() >= 1024)
+            flushChains();
+    }
+
+    for (const std::pair<int,int> &edge : nodes[n].edges) {
+        /* Check that the target can still be reached in max_level */
+        if ((length + nodes[edge.first].depth) >= max_level)
+            continue;
+        offsets[length] = edge.second;
+        if (!enumerateChains(base_address, edge.first, length + 1, offsets))
+            return false;
+    }
+    return true;
+}
+
+void PointerScanModel::flushChains()
+{
+    if (pending_chains.empty())
+        return;
+
+    beginInsertRows(QModelIndex(), pointer_chains.size(), pointer_chains.size() + pending_chains.size() - 1);
+    pointer_chains.insert(pointer_chains.end(), pending_chains.begin(), pending_chains.end());
+    endInsertRows();
+    pending_chains.clear();
+}
+
+/* Location of a static section relative to its file. BSS sections have no
+ * file, so they are located relative to the file section before them. */
+struct FileLocation {
+    std::string filename;
+    uintptr_t addr;
+    uintptr_t endaddr;
+    off_t offset;
+};
+
+static std::vector<FileLocation> fileLocations(const std::vector<MemSection>& sections)
+{
+    std::vector<FileLocation> locations;
+    for (const MemSection &section : sections) {
+        if (!(section.type & (MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemFileMappingRW)))
+            continue;
+
+        FileLocation location = {section.filename, section.addr, section.endaddr, section.offset};
+        if (section.filename.empty() && !locations.empty()) {
+            location.filename = locations.back().filename;
+            location.offset = locations.back().offset + (section.addr - locations.back().addr);
+        }
+        locations.push_back(location);
+    }
+    return locations;
 }
 
-void PointerScanModel::recursiveFind(uintptr_t addr, int level, int offsets[], int max_offset)
+void PointerScanModel::filterChains(uintptr_t target)
 {
-    /* Search inside static data */
-    auto iter = static_pointer_map.lower_bound(addr - max_offset);
-    while ((iter != static_pointer_map.end()) && (iter->first <= addr)) {
-        offsets[level] = addr - iter->first;
-        uintptr_t base_address = iter->second;
-        // std::cout << "Found static chain with last offset " << std::dec << offsets[level] << " and base address " << std::hex << base_address << std::endl;
-        std::vector<int> offset_vec(offsets, offsets + level + 1);
-        pointer_chains.push_back(std::make_pair(base_address,offset_vec));
-        iter++;
+    std::vector<MemSection> sections;
+    if (!getSections(sections))
+        return;
+
+    /* Chain base addresses are from the scanned memory. Translate them
+     * using their file and offset, so that chains can be checked after a
+     * game restart. */
+    std::vector<FileLocation> old_locations = fileLocations(file_mapping_sections);
+    std::vector<FileLocation> new_locations = fileLocations(sections);
+
+    size_t chain_count = pointer_chains.size();
+    std::vector<uintptr_t> addresses(chain_count);
+    std::vector<char> valid(chain_count, true);
+
+    for (size_t c = 0; c < chain_count; c++) {
+        uintptr_t base = pointer_chains[c].first;
+        addresses[c] = base;
+        for (const FileLocation &old_loc : old_locations) {
+            if ((base < old_loc.addr) || (base >= old_loc.endaddr))
+                continue;
+            off_t file_offset = old_loc.offset + (base - old_loc.addr);
+            for (const FileLocation &new_loc : new_locations) {
+                if ((new_loc.filename == old_loc.filename) &&
+                    (file_offset >= new_loc.offset) &&
+                    (file_offset < static_cast<off_t>(new_loc.offset + (new_loc.endaddr - new_loc.addr)))) {
+                    addresses[c] = new_loc.addr + (file_offset - new_loc.offset);
+                    break;
+                }
+            }
+            break;
+        }
     }
 
-    /* Stop if we reached the last level */
-    if (level == (max_level-1))
+    /* Follow all chains of a chunk one level at a time, so that the
+     * pointers of each level are read in a single batch. Chunks are
+     * processed in parallel. */
+    static const size_t CHUNK_SIZE = 4096;
+    size_t chunk_count = (chain_count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    std::atomic<int> done(0);
+
+    parallelScan(chunk_count, [this, chain_count, &addresses, &valid, &done] (size_t k) {
+        size_t first = k * CHUNK_SIZE;
+        size_t last = std::min(first + CHUNK_SIZE, chain_count);
+
+        std::vector<size_t> indices;
+        std::vector<uintptr_t> values;
+        std::vector<bool> read_valid;
+        for (int level = 0; level < max_level; level++) {
+            /* Gather the chains that still have a pointer to read */
+            indices.clear();
+            for (size_t c = first; c < last; c++) {
+                if (valid[c] && (level < static_cast<int>(pointer_chains[c].second.size())))
+                    indices.push_back(c);
+            }
+            if (indices.empty())
+                break;
+
+            std::vector<uintptr_t> read_addresses(indices.size());
+            for (size_t i = 0; i < indices.size(); i++)
+                read_addresses[i] = addresses[indices[i]];
+
+            readPointers(read_addresses, values, read_valid);
+
+            /* Offsets are stored in reverse order */
+            for (size_t i = 0; i < indices.size(); i++) {
+                size_t c = indices[i];
+                if (!read_valid[i]) {
+                    valid[c] = false;
+                    continue;
+                }
+                const std::vector<int> &offsets = pointer_chains[c].second;
+                addresses[c] = values[i] + offsets[offsets.size() - 1 - level];
+            }
+        }
+
+        done += last - first;
+    }, [this, &done, chain_count] () {
+        emit signalProgress((int)(100 * ((float)done / chain_count)));
+        return true;
+    });
+
+    beginResetModel();
+    size_t kept = 0;
+    for (size_t c = 0; c < chain_count; c++) {
+        if (valid[c] && (addresses[c] == target)) {
+            if (kept != c)
+                pointer_chains[kept] = std::move(pointer_chains[c]);
+            kept++;
+        }
+    }
+    pointer_chains.erase(pointer_chains.begin() + kept, pointer_chains.end());
+    endResetModel();
+}
+
+void PointerScanModel::readPointers(const std::vector<uintptr_t>& addresses, std::vector<uintptr_t>& values, std::vector<bool>& valid)
+{
+    size_t count = addresses.size();
+    values.assign(count, 0);
+    valid.assign(count, false);
+
+    if (savestate) {
+        /* Keep the last decompressed page, because pointers of close chains
+         * are often on the same page */
+        uint8_t page[4096];
+        uintptr_t page_addr = 0;
+        bool page_valid = false;
+        for (size_t i = 0; i < count; i++) {
+            uintptr_t addr = addresses[i] & ~static_cast<uintptr_t>(4095);
+            if ((addr != page_addr) || (i == 0)) {
+                page_addr = addr;
+                page_valid = savestate->readPage(addr, page);
+            }
+            /* Pointers crossing a page boundary are not supported */
+            if (page_valid && ((addresses[i] & 4095) <= (4096 - sizeof(uintptr_t)))) {
+                memcpy(&values[i], page + (addresses[i] & 4095), sizeof(uintptr_t));
+                valid[i] = true;
+            }
+        }
         return;
+    }
+
+    /* Read all pointers with as few process_vm_readv calls as possible */
+    static const size_t MAX_IOV = 1024; // IOV_MAX
+    struct iovec locals[MAX_IOV];
+    struct iovec remotes[MAX_IOV];
+
+    size_t p = 0;
+    while (p < count) {
+        size_t n = std::min(count - p, MAX_IOV);
+        for (size_t i = 0; i < n; i++) {
+            locals[i].iov_base = static_cast<void*>(&values[p + i]);
+            locals[i].iov_len = sizeof(uintptr_t);
+            remotes[i].iov_base = reinterpret_cast<void*>(addresses[p + i]);
+            remotes[i].iov_len = sizeof(uintptr_t);
+        }
 
-    /* Search inside dynamic data */
-    iter = pointer_map.lower_bound(addr - max_offset);
-    while ((iter != pointer_map.end()) && (iter->first <= addr)) {
-        offsets[level] = addr - iter->first;
-        uintptr_t base_address = iter->second;
-        // std::cout << "Found chain with offset " << std::dec << offsets[level] << " and base address " << std::hex << base_address << std::endl;
-        recursiveFind(base_address, level+1, offsets, max_offset);
-        iter++;
+        /* The call stops at the first address that cannot be read, so we
+         * skip it and continue with the next ones. */
+        ssize_t ret = process_vm_readv(context->game_pid, locals, n, remotes, n, 0);
+        size_t read_count = (ret > 0) ? (ret / sizeof(uintptr_t)) : 0;
+        for (size_t i = 0; i < read_count; i++)
+            valid[p + i] = true;
+        p += read_count;
+        if (read_count < n)
+            p++;
     }
 }
 
+void PointerScanModel::stopSearch()
+{
+    stop_requested = true;
+}
+
 int PointerScanModel::rowCount(const QModelIndex & /*parent*/) const
 {
     return pointer_chains.size();
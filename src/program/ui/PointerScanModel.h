@@ -22,13 +22,13 @@
 
 #include <QAbstractTableModel>
 #include <vector>
-#include <map>
 // #include <pair>
 #include <memory>
 #include <sys/types.h>
 
 #include "../Context.h"
 #include "../ramsearch/MemSection.h"
+#include "../ramsearch/SaveStateFile.h"
 
 class PointerScanModel : public QAbstractTableModel {
     Q_OBJECT
@@ -36,11 +36,15 @@ class PointerScanModel : public QAbstractTableModel {
 public:
     PointerScanModel(Context* c, QObject *parent = Q_NULLPTR);
 
-    /* Map of pointers (key) and addresses (value) */
-    std::multimap<uintptr_t,uintptr_t> pointer_map;
+    /* Pointer value and address where the pointer is stored */
+    typedef std::pair<uintptr_t,uintptr_t> PointerEntry;
 
-    /* Map of pointers (key) and addresses (value) that are in a static area */
-    std::multimap<uintptr_t,uintptr_t> static_pointer_map;
+    /* Pointers sorted by value then by address. A flat array uses much less
+     * memory than a map and is faster to search. */
+    std::vector<PointerEntry> pointer_map;
+
+    /* Pointers that are in a static area, sorted the same way */
+    std::vector<PointerEntry> static_pointer_map;
 
     /* Results of pointer scan */
     std::vector<std::pair<uintptr_t, std::vector<int>>> pointer_chains;
@@ -51,23 +55,69 @@ public:
     /* Get the file and file offset from an address */
     std::string getFileAndOffset(uintptr_t& addr) const;
 
-    /* Store all pointers from the game memory into a map */
-    void locatePointers();
+    /* Read the memory from the game process (slot 0) or from a savestate
+     * slot. Returns false if the savestate could not be opened. */
+    bool setMemorySource(int slot);
+
+    /* Store all pointers from the game memory into a map. Returns false if
+     * the memory could not be read or if the search was stopped */
+    bool locatePointers();
 
     /* Find all chains of pointers that start from a static address and
      * end with the specified address, in maximum `ml` levels and with a maximum
-     * offset of `max_offset`
+     * offset of `max_offset`. Stops after `max_results` chains. Results are
+     * added to the model during the search.
      */
-    void findPointerChain(uintptr_t addr, int ml, int max_offset);
+    void findPointerChain(uintptr_t addr, int ml, int max_offset, int max_results);
+
+    /* Only keep the chains that resolve to `target` in the current memory
+     * source, which can be another savestate or another game execution */
+    void filterChains(uintptr_t target);
+
+    /* Stop the current pointer chain search */
+    void stopSearch();
 
 private:
     Context *context;
 
+    /* Savestate that the memory is read from, if any */
+    std::unique_ptr<SaveStateFile> savestate;
+    int memory_slot = 0;
+
     /* File mapping sections */
     std::vector<MemSection> file_mapping_sections;
 
-    /* Recursive call for the pointer chain search */
-    void recursiveFind(uintptr_t addr, int level, int offsets[], int max_offset);
+    /* Get the memory sections of the game or of the savestate */
+    bool getSections(std::vector<MemSection>& sections);
+
+    /* Read pointers at the given addresses from the game or the savestate */
+    void readPointers(const std::vector<uintptr_t>& addresses, std::vector<uintptr_t>& values, std::vector<bool>& valid);
+
+    /* Merge sorted lists of pointers into a single sorted list */
+    static void mergeLists(std::vector<std::vector<PointerEntry>>& lists, std::vector<PointerEntry>& merged);
+
+    /* Address that can reach the target address of the pointer chain
+     * search, with its minimal number of levels to the target, and the
+     * edges (node index and offset) towards the target */
+    struct ChainNode {
+        uintptr_t addr;
+        int depth;
+        std::vector<std::pair<int,int>> edges;
+    };
+    std::vector<ChainNode> nodes;
+
+    /* Chains found and not yet inserted in the model */
+    std::vector<std::pair<uintptr_t, std::vector<int>>> pending_chains;
+
+    int max_results;
+    bool stop_requested;
+
+    /* Enumerate all chains from a node to the target, after `length`
+     * offsets. Returns false if the maximum number of results was reached */
+    bool enumerateChains(uintptr_t base_address, int n, int length, int offsets[]);
+
+    /* Insert the pending chains into the model */
+    void flushChains();
 
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
 
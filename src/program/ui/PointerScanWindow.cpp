@@ -76,21 +76,42 @@ PointerScanWindow::PointerScanWindow(Context* c, QWidget *parent, Qt::WindowFlag
     maxOffsetInput = new QSpinBox();
     maxOffsetInput->setMaximum(10000);
     maxOffsetInput->setValue(1000);
+    maxResultsInput = new QSpinBox();
+    maxResultsInput->setRange(1, 10000000);
+    maxResultsInput->setValue(100000);
+
+    sourceBox = new QComboBox();
+    sourceBox->addItem("Game");
+    for (int i = 1; i <= 9; i++)
+        sourceBox->addItem(QString("Savestate %1").arg(i));
+    sourceBox->addItem("Backtrack savestate");
 
     QFormLayout *formLayout = new QFormLayout;
+    formLayout->addRow(new QLabel(tr("Memory:")), sourceBox);
     formLayout->addRow(new QLabel(tr("Address:")), addressInput);
     formLayout->addRow(new QLabel(tr("Max level:")), maxLevelInput);
     formLayout->addRow(new QLabel(tr("Max offset:")), maxOffsetInput);
+    formLayout->addRow(new QLabel(tr("Max results:")), maxResultsInput);
 
     /* Buttons */
-    QPushButton *searchButton = new QPushButton(tr("Search"));
+    searchButton = new QPushButton(tr("Search"));
     connect(searchButton, &QAbstractButton::clicked, this, &PointerScanWindow::slotSearch);
 
-    QPushButton *addButton = new QPushButton(tr("Add Watch"));
+    stopButton = new QPushButton(tr("Stop"));
+    stopButton->setEnabled(false);
+    connect(stopButton, &QAbstractButton::clicked, pointerScanModel, &PointerScanModel::stopSearch);
+
+    filterButton = new QPushButton(tr("Filter"));
+    filterButton->setToolTip(tr("Only keep the chains pointing to the address in the selected memory"));
+    connect(filterButton, &QAbstractButton::clicked, this, &PointerScanWindow::slotFilter);
+
+    addButton = new QPushButton(tr("Add Watch"));
     connect(addButton, &QAbstractButton::clicked, this, &PointerScanWindow::slotAdd);
 
     QDialogButtonBox *buttonBox = new QDialogButtonBox();
     buttonBox->addButton(searchButton, QDialogButtonBox::ActionRole);
+    buttonBox->addButton(stopButton, QDialogButtonBox::ActionRole);
+    buttonBox->addButton(filterButton, QDialogButtonBox::ActionRole);
     buttonBox->addButton(addButton, QDialogButtonBox::ActionRole);
 
     /* Create the options layout */
@@ -118,12 +139,29 @@ void PointerScanWindow::slotSearch()
     int max_level = maxLevelInput->value();
     int max_offset = maxOffsetInput->value();
 
+    if (!pointerScanModel->setMemorySource(sourceBox->currentIndex())) {
+        QMessageBox::critical(nullptr, "Error", QString("Could not open the savestate. Savestates stored in RAM cannot be scanned."));
+        return;
+    }
+
     scanCount->hide();
     searchProgress->show();
+    /* Events are processed during the search, so disable everything that
+     * would modify the memory source or the results in the meantime */
+    searchButton->setEnabled(false);
+    filterButton->setEnabled(false);
+    addButton->setEnabled(false);
+    sourceBox->setEnabled(false);
+    stopButton->setEnabled(true);
 
-    pointerScanModel->findPointerChain(addr, max_level, max_offset);
+    pointerScanModel->findPointerChain(addr, max_level, max_offset, maxResultsInput->value());
 
     /* Update address count */
+    searchButton->setEnabled(true);
+    filterButton->setEnabled(true);
+    addButton->setEnabled(true);
+    sourceBox->setEnabled(true);
+    stopButton->setEnabled(false);
     searchProgress->hide();
     scanCount->show();
     scanCount->setText(QString("%1 results").arg(pointerScanModel->pointer_chains.size()));
@@ -134,6 +172,29 @@ void PointerScanWindow::slotSearch()
     }
 }
 
+void PointerScanWindow::slotFilter()
+{
+    bool ok;
+    uintptr_t addr = addressInput->text().toULong(&ok, 16);
+
+    if (!ok)
+        return;
+
+    if (!pointerScanModel->setMemorySource(sourceBox->currentIndex())) {
+        QMessageBox::critical(nullptr, "Error", QString("Could not open the savestate. Savestates stored in RAM cannot be scanned."));
+        return;
+    }
+
+    scanCount->hide();
+    searchProgress->show();
+
+    pointerScanModel->filterChains(addr);
+
+    searchProgress->hide();
+    scanCount->show();
+    scanCount->setText(QString("%1 results").arg(pointerScanModel->pointer_chains.size()));
+}
+
 void PointerScanWindow::slotAdd()
 {
     const QModelIndex index = pointerScanView->selectionModel()->currentIndex();
@@ -28,6 +28,7 @@
 #include <QComboBox>
 #include <QProgressBar>
 #include <QLabel>
+#include <QPushButton>
 #include <QSortFilterProxyModel>
 #include <memory>
 
@@ -50,11 +51,18 @@ private:
     QProgressBar *searchProgress;
     QLabel *scanCount;
 
+    QComboBox *sourceBox;
     QSpinBox *maxLevelInput;
     QSpinBox *maxOffsetInput;
+    QSpinBox *maxResultsInput;
+    QPushButton *searchButton;
+    QPushButton *stopButton;
+    QPushButton *filterButton;
+    QPushButton *addButton;
 
 private slots:
     void slotSearch();
+    void slotFilter();
     void slotAdd();
 
 };
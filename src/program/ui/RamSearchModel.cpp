@@ -18,13 +18,17 @@
  */
 
 #include "RamSearchModel.h"
+#include "../ramsearch/ParallelScan.h"
 #include <QMessageBox>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
 
-RamSearchModel::RamSearchModel(Context* c, QObject *parent) : QAbstractTableModel(parent), context(c) {}
+RamSearchModel::RamSearchModel(Context* c, QObject *parent) : QAbstractTableModel(parent), context(c), candidate_count(0) {}
 
 int RamSearchModel::rowCount(const QModelIndex & /*parent*/) const
 {
-   return ramwatches.size();
+   return candidate_count;
 }
 
 int RamSearchModel::columnCount(const QModelIndex & /*parent*/) const
@@ -52,7 +56,7 @@ QVariant RamSearchModel::headerData(int section, Qt::Orientation orientation, in
 QVariant RamSearchModel::data(const QModelIndex &index, int role) const
 {
     if (role == Qt::DisplayRole) {
-        const RamWatch &watch = ramwatches.at(index.row());
+        const RamWatch watch = watchAt(index.row());
         switch(index.column()) {
             case 0:
                 return QString("%1").arg(watch.address, 0, 16);
@@ -67,25 +71,63 @@ QVariant RamSearchModel::data(const QModelIndex &index, int role) const
     return QVariant();
 }
 
-int RamSearchModel::predictWatchCount(int mem_filter)
+bool RamSearchModel::setMemorySource(int slot)
 {
+    RamWatch::savestate = nullptr;
+    savestate.reset();
+
+    if (slot == 0)
+        return true;
+
+    savestate.reset(new SaveStateFile(
+        SaveStateFile::slotPath(context->config.savestatedir, context->gamename, slot),
+        SaveStateFile::slotPath(context->config.savestatedir, context->gamename, 0)));
+    if (!*savestate) {
+        savestate.reset();
+        return false;
+    }
+
+    RamWatch::savestate = savestate.get();
+    return true;
+}
+
+bool RamSearchModel::getSections(std::vector<MemSection>& sections)
+{
+    sections.clear();
+
+    if (savestate) {
+        sections = savestate->getSections();
+        return true;
+    }
+
     /* Compose the filename for the /proc memory map, and open it. */
     std::ostringstream oss;
     oss << "/proc/" << context->game_pid << "/maps";
     std::ifstream mapsfile(oss.str());
     if (!mapsfile) {
         std::cerr << "Could not open " << oss.str() << std::endl;
-        return 0;
+        return false;
     }
 
     std::string line;
     MemSection::reset();
 
-    int total_size = 0;
     while (std::getline(mapsfile, line)) {
         MemSection section;
         section.readMap(line);
+        sections.push_back(section);
+    }
+
+    return true;
+}
 
+int RamSearchModel::predictWatchCount(int mem_filter)
+{
+    std::vector<MemSection> sections;
+    getSections(sections);
+
+    int total_size = 0;
+    for (const MemSection &section : sections) {
         /* Filter based on type */
         if (!(mem_filter & section.type))
             continue;
@@ -98,7 +140,45 @@ int RamSearchModel::predictWatchCount(int mem_filter)
 
 int RamSearchModel::watchCount()
 {
-    return ramwatches.size();
+    return candidate_count;
+}
+
+RamWatch RamSearchModel::watchAt(int row) const
+{
+    if (regions.empty())
+        return ramwatches.at(row);
+
+    size_t n = row;
+    for (const SearchRegion& region : regions) {
+        if (n < region.count)
+            return region.watchAt(n);
+        n -= region.count;
+    }
+    return RamWatch(0);
+}
+
+void RamSearchModel::updateCount()
+{
+    if (regions.empty()) {
+        candidate_count = ramwatches.size();
+        return;
+    }
+
+    candidate_count = 0;
+    size_t snapshot_size = 0;
+    for (const SearchRegion& region : regions) {
+        candidate_count += region.count;
+        snapshot_size += region.memorySize();
+    }
+
+    /* Switch to a list of watches once it takes less memory than the
+     * region snapshots */
+    if (candidate_count * sizeof(RamWatch) < snapshot_size) {
+        ramwatches.reserve(candidate_count);
+        for (const SearchRegion& region : regions)
+            region.appendWatches(ramwatches);
+        regions.clear();
+    }
 }
 
 void RamSearchModel::newWatches(int mem_filter, int type, CompareType ct, CompareOperator co, double cv)
@@ -110,84 +190,210 @@ void RamSearchModel::newWatches(int mem_filter, int type, CompareType ct, Compar
     beginResetModel();
 
     ramwatches.clear();
-    ramwatches.reserve(0);
+    ramwatches.shrink_to_fit();
+    regions.clear();
+    candidate_count = 0;
 
     RamWatch::game_pid = context->game_pid;
     RamWatch::type = type;
     RamWatch::type_size = RamWatch::type_to_size();
 
-    /* Compose the filename for the /proc memory map, and open it. */
-    std::ostringstream oss;
-    oss << "/proc/" << context->game_pid << "/maps";
-    std::ifstream mapsfile(oss.str());
-    if (!mapsfile) {
-        std::cerr << "Could not open " << oss.str() << std::endl;
+    std::vector<MemSection> sections;
+    if (!getSections(sections)) {
+        endResetModel();
         return;
     }
 
-    std::string line;
-    MemSection::reset();
-
-    int cur_size = 0;
-    while (std::getline(mapsfile, line)) {
-
-        MemSection section;
-        section.readMap(line);
-
+    for (const MemSection &section : sections) {
         /* Filter based on type */
         if (!(mem_filter & section.type))
             continue;
 
-        struct iovec local, remote;
+        regions.emplace_back(section.addr, section.size);
+    }
 
-        /* Read values in chunks of 4096 bytes so we lower the number
-         * of `process_vm_readv` calls. */
-        uint8_t chunk[4096];
-        local.iov_base = static_cast<void*>(chunk);
-        local.iov_len = 4096;
-        remote.iov_len = 4096;
+    /* Snapshot all regions in parallel */
+    std::atomic<int> cur_size(0);
+    try {
+        parallelScan(regions.size(), [this, &cur_size] (size_t i) {
+            SearchRegion &region = regions[i];
+            region.snapshot(context->game_pid);
 
-        for (uintptr_t addr = section.addr; addr < section.endaddr; addr += 4096) {
+            /* If only insert watches that match the compare */
+            if (compare_type == CompareType::Value) {
+                region.filter(compare_type, compare_operator, compare_value);
+            }
 
-            remote.iov_base = reinterpret_cast<void*>(addr);
+            cur_size += region.size;
+        }, [this, &cur_size] () {
+            emit signalProgress(cur_size);
+            return true;
+        });
+    }
+    catch (const std::bad_alloc &e)
+    {
+        regions.clear();
+        regions.shrink_to_fit();
+        endResetModel();
+        QMessageBox::critical(nullptr, tr("Error"), tr("No more available memory."));
+        return;
+    }
 
-            int readValues = process_vm_readv(context->game_pid, &local, 1, &remote, 1, 0);
-            if (readValues < 0) {
-                continue;
+    /* Drop regions without any candidate */
+    regions.erase(
+        std::remove_if(regions.begin(), regions.end(),
+            [] (const SearchRegion &region) {
+                return region.count == 0;
+            }),
+        regions.end());
+
+    updateCount();
+
+    endResetModel();
+}
+
+void RamSearchModel::searchWatches(CompareType ct, CompareOperator co, double cv)
+{
+    compare_type = ct;
+    compare_operator = co;
+    compare_value = cv;
+
+    beginResetModel();
+
+    if (!regions.empty()) {
+        /* Search each region snapshot in parallel */
+        std::atomic<int> count(0);
+        parallelScan(regions.size(), [this, &count] (size_t i) {
+            count += regions[i].count;
+            regions[i].search(context->game_pid, compare_type, compare_operator, compare_value);
+        }, [this, &count] () {
+            emit signalProgress(count);
+            return true;
+        });
+
+        regions.erase(
+            std::remove_if(regions.begin(), regions.end(),
+                [] (const SearchRegion &region) {
+                    return region.count == 0;
+                }),
+            regions.end());
+    }
+    else {
+        searchSparseWatches();
+    }
+
+    updateCount();
+
+    endResetModel();
+}
+
+void RamSearchModel::searchSparseWatches()
+{
+    /* Split the watches into chunks that are filtered in parallel, each
+     * chunk being compacted in place. Then move the remaining watches of
+     * each chunk together, which keeps them sorted by address. */
+    static const size_t CHUNK_SIZE = 1 << 16;
+    size_t n = ramwatches.size();
+    size_t chunk_count = (n + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    std::vector<size_t> chunk_kept(chunk_count);
+
+    std::atomic<int> count(0);
+    parallelScan(chunk_count, [this, n, &chunk_kept, &count] (size_t c) {
+        size_t first = c * CHUNK_SIZE;
+        size_t last = std::min(first + CHUNK_SIZE, n);
+        chunk_kept[c] = filterWatches(first, last);
+        count += last - first;
+    }, [this, &count] () {
+        emit signalProgress(count);
+        return true;
+    });
+
+    size_t kept = 0;
+    for (size_t c = 0; c < chunk_count; c++) {
+        size_t first = c * CHUNK_SIZE;
+        if (kept != first)
+            std::copy(ramwatches.begin() + first, ramwatches.begin() + first + chunk_kept[c], ramwatches.begin() + kept);
+        kept += chunk_kept[c];
+    }
+
+    ramwatches.erase(ramwatches.begin() + kept, ramwatches.end());
+}
+
+size_t RamSearchModel::filterWatches(size_t begin, size_t end)
+{
+    /* Watches are sorted by address, so we read all the pages that contain
+     * a watch in a single `process_vm_readv` call with one iovec per page,
+     * then filter the watches from the local copy. */
+    static const int PAGE_SIZE = 4096;
+    static const size_t MAX_PAGES = 1024; // IOV_MAX
+    std::vector<uint8_t> buffer(MAX_PAGES * PAGE_SIZE);
+    std::vector<uintptr_t> pages;
+    std::vector<bool> page_valid;
+
+    size_t kept = begin;
+    size_t first = begin;
+    while (first < end) {
+
+        /* Gather the pages of the next batch of watches */
+        pages.clear();
+        size_t last = first;
+        for (; last < end; last++) {
+            uintptr_t page = ramwatches[last].address & ~static_cast<uintptr_t>(PAGE_SIZE - 1);
+            if (pages.empty() || (pages.back() != page)) {
+                if (pages.size() == MAX_PAGES)
+                    break;
+                pages.push_back(page);
             }
+        }
+
+        readPages(context->game_pid, pages, buffer.data(), page_valid);
 
-            for (int i = 0; i < readValues; i += RamWatch::type_size, cur_size += RamWatch::type_size) {
-
-                if (!(cur_size & 0xfff)) {
-                    emit signalProgress(cur_size);
-                }
-
-                try {
-                    ramwatches.emplace_back(addr+i);
-                }
-                catch (const std::bad_alloc &e)
-                {
-                    ramwatches.clear();
-                    ramwatches.reserve(0);
-                    QMessageBox::critical(nullptr, tr("Error"), tr("No more available memory."));
-                    return;
-                }
-                memcpy(&ramwatches.back().previous_value, chunk+i, RamWatch::type_size);
-
-                /* If only insert watches that match the compare */
-                if (compare_type == CompareType::Value) {
-                    if (ramwatches.back().check(ramwatches.back().previous_value, compare_type, compare_operator, compare_value)) {
-                        ramwatches.pop_back();
-                    }
-                }
+        /* Filter the watches of this batch */
+        int page_index = -1;
+        for (size_t w = first; w < last; w++) {
+            RamWatch &watch = ramwatches[w];
+            uintptr_t page = watch.address & ~static_cast<uintptr_t>(PAGE_SIZE - 1);
+            if ((page_index < 0) || (page != pages[page_index])) {
+                page_index++;
             }
+
+            if (!page_valid[page_index])
+                continue;
+
+            uint64_t value = 0;
+            memcpy(&value, buffer.data() + page_index * PAGE_SIZE + (watch.address - page), RamWatch::type_size);
+
+            bool removed = watch.check(value, compare_type, compare_operator, compare_value);
+            watch.previous_value = value;
+            if (!removed)
+                ramwatches[kept++] = watch;
         }
+
+        first = last;
     }
 
-    endResetModel();
+    return kept - begin;
 }
 
-void RamSearchModel::searchWatches(CompareType ct, CompareOperator co, double cv)
+void RamSearchModel::startHistory()
+{
+    std::vector<uintptr_t> pages;
+    if (!regions.empty()) {
+        for (const SearchRegion& region : regions)
+            region.appendPages(pages);
+    }
+    else {
+        for (const RamWatch& watch : ramwatches) {
+            uintptr_t page = watch.address & ~static_cast<uintptr_t>(4095);
+            if (pages.empty() || (pages.back() != page))
+                pages.push_back(page);
+        }
+    }
+
+    history.start(pages);
+}
+
+void RamSearchModel::searchHistory(CompareType ct, CompareOperator co, double cv, MemoryHistory::QueryMode mode, int n)
 {
     compare_type = ct;
     compare_operator = co;
@@ -195,16 +401,18 @@ void RamSearchModel::searchWatches(CompareType ct, CompareOperator co, double cv
 
     beginResetModel();
 
-    int count = 0;
-    ramwatches.erase(
-        std::remove_if(ramwatches.begin(), ramwatches.end(),
-            [this, &count] (RamWatch &watch) {
-                if (!(count++ & 0xfff)) {
-                    emit signalProgress(count);
-                }
-                return watch.check_update(compare_type, compare_operator, compare_value);
-            }),
-        ramwatches.end());
+    /* Convert the region snapshots into a list of watches */
+    if (!regions.empty()) {
+        ramwatches.clear();
+        ramwatches.reserve(candidate_count);
+        for (const SearchRegion& region : regions)
+            region.appendWatches(ramwatches);
+        regions.clear();
+    }
+
+    history.query(ramwatches, compare_type, compare_operator, compare_value, mode, n);
+
+    updateCount();
 
     endResetModel();
 }
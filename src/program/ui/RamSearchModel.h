@@ -32,6 +32,9 @@
 #include "../ramsearch/CompareEnums.h"
 #include "../ramsearch/RamWatch.h"
 #include "../ramsearch/MemSection.h"
+#include "../ramsearch/SearchRegion.h"
+#include "../ramsearch/SaveStateFile.h"
+#include "../ramsearch/MemoryHistory.h"
 
 class RamSearchModel : public QAbstractTableModel {
     Q_OBJECT
@@ -41,7 +44,11 @@ public:
 
     void update();
 
-    /* List of watches */
+    /* Region snapshots with a bitmap of candidates, used while there are
+     * many candidates */
+    std::vector<SearchRegion> regions;
+
+    /* List of watches, used when the region snapshots were converted */
     std::vector<RamWatch> ramwatches;
 
     /* Flag if we display values in hex or decimal */
@@ -57,13 +64,50 @@ public:
     // void new_watches(pid_t pid, int type_filter, CompareType compare_type, CompareOperator compare_operator, double compare_value, Fl_Hor_Fill_Slider *search_progress)
     void newWatches(int mem_filter, int type, CompareType ct, CompareOperator co, double cv);
 
+    /* Read the memory from the game process (slot 0) or from a savestate
+     * slot. Returns false if the savestate could not be opened. */
+    bool setMemorySource(int slot);
+
     int predictWatchCount(int type_filter);
     int watchCount();
     void searchWatches(CompareType ct, CompareOperator co, double cv);
 
+    /* Get the watch at a given row */
+    RamWatch watchAt(int row) const;
+
+    /* Recorded history of the candidate pages */
+    MemoryHistory history;
+
+    /* Start recording the pages containing the current candidates */
+    void startHistory();
+
+    /* Only keep the candidates matching the comparison over the recorded
+     * history */
+    void searchHistory(CompareType ct, CompareOperator co, double cv, MemoryHistory::QueryMode mode, int n);
+
 private:
     Context *context;
 
+    /* Savestate that the memory is read from, if any */
+    std::unique_ptr<SaveStateFile> savestate;
+
+    /* Get the memory sections of the game or of the savestate */
+    bool getSections(std::vector<MemSection>& sections);
+
+    /* Number of remaining candidates */
+    size_t candidate_count;
+
+    /* Update the candidate count, and convert the region snapshots into a
+     * list of watches if there are few candidates left */
+    void updateCount();
+
+    /* Search the list of watches */
+    void searchSparseWatches();
+
+    /* Filter the watches in [begin, end), moving the remaining ones at the
+     * beginning of the range. Returns the number of remaining watches. */
+    size_t filterWatches(size_t begin, size_t end);
+
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
 
     int columnCount(const QModelIndex &parent = QModelIndex()) const override;
@@ -126,6 +126,12 @@ RamSearchWindow::RamSearchWindow(Context* c, QWidget *parent, Qt::WindowFlags fl
     operatorGroupBox->setLayout(operatorLayout);
 
     /* Format */
+    sourceBox = new QComboBox();
+    sourceBox->addItem("Game");
+    for (int i = 1; i <= 9; i++)
+        sourceBox->addItem(QString("Savestate %1").arg(i));
+    sourceBox->addItem("Backtrack savestate");
+
     typeBox = new QComboBox();
     QStringList typeList;
     typeList << "unsigned char" << "char" << "unsigned short" << "short";
@@ -139,10 +145,37 @@ RamSearchWindow::RamSearchWindow(Context* c, QWidget *parent, Qt::WindowFlags fl
 
     QGroupBox *formatGroupBox = new QGroupBox(tr("Format"));
     QFormLayout *formatLayout = new QFormLayout;
+    formatLayout->addRow(new QLabel(tr("Memory:")), sourceBox);
     formatLayout->addRow(new QLabel(tr("Type:")), typeBox);
     formatLayout->addRow(new QLabel(tr("Display:")), displayBox);
     formatGroupBox->setLayout(formatLayout);
 
+    /* Frame history */
+    recordButton = new QPushButton(tr("Start Recording"));
+    connect(recordButton, &QAbstractButton::clicked, this, &RamSearchWindow::slotRecord);
+
+    historyLabel = new QLabel(tr("No frame recorded"));
+
+    historyModeBox = new QComboBox();
+    historyModeBox->addItem("On all frames");
+    historyModeBox->addItem("On at least N frames");
+    historyModeBox->addItem("On N consecutive frames");
+
+    historyFramesBox = new QSpinBox();
+    historyFramesBox->setRange(1, 1000000);
+    historyFramesBox->setValue(30);
+
+    QPushButton *searchHistoryButton = new QPushButton(tr("Search History"));
+    connect(searchHistoryButton, &QAbstractButton::clicked, this, &RamSearchWindow::slotSearchHistory);
+
+    QGroupBox *historyGroupBox = new QGroupBox(tr("Frame History"));
+    QFormLayout *historyLayout = new QFormLayout;
+    historyLayout->addRow(recordButton, historyLabel);
+    historyLayout->addRow(new QLabel(tr("Match:")), historyModeBox);
+    historyLayout->addRow(new QLabel(tr("N:")), historyFramesBox);
+    historyLayout->addRow(searchHistoryButton);
+    historyGroupBox->setLayout(historyLayout);
+
     /* Buttons */
     QPushButton *newButton = new QPushButton(tr("New"));
     connect(newButton, &QAbstractButton::clicked, this, &RamSearchWindow::slotNew);
@@ -164,6 +197,7 @@ RamSearchWindow::RamSearchWindow(Context* c, QWidget *parent, Qt::WindowFlags fl
     optionLayout->addWidget(compareGroupBox);
     optionLayout->addWidget(operatorGroupBox);
     optionLayout->addWidget(formatGroupBox);
+    optionLayout->addWidget(historyGroupBox);
     optionLayout->addStretch(1);
     optionLayout->addWidget(buttonBox);
 
@@ -178,6 +212,15 @@ RamSearchWindow::RamSearchWindow(Context* c, QWidget *parent, Qt::WindowFlags fl
 void RamSearchWindow::update()
 {
     ramSearchModel->update();
+
+    if (ramSearchModel->history.isRecording()) {
+        historyLabel->setText(QString("%1 frames recorded (%2 kB)").arg(ramSearchModel->history.frameCount()).arg(ramSearchModel->history.memorySize() / 1024));
+    }
+}
+
+void RamSearchWindow::recordHistory(unsigned long long framecount)
+{
+    ramSearchModel->history.record(context->game_pid, framecount);
 }
 
 void RamSearchWindow::getCompareParameters(CompareType& compare_type, CompareOperator& compare_operator, double& compare_value)
@@ -201,9 +244,23 @@ void RamSearchWindow::getCompareParameters(CompareType& compare_type, CompareOpe
         compare_operator = CompareOperator::GreaterEqual;
 }
 
+bool RamSearchWindow::selectMemorySource()
+{
+    /* Savestates can be scanned without a running game */
+    int slot = sourceBox->currentIndex();
+    if ((slot == 0) && (context->status != Context::ACTIVE))
+        return false;
+
+    if (!ramSearchModel->setMemorySource(slot)) {
+        QMessageBox::critical(nullptr, "Error", QString("Could not open the savestate. Savestates stored in RAM cannot be scanned."));
+        return false;
+    }
+    return true;
+}
+
 void RamSearchWindow::slotNew()
 {
-    if (context->status != Context::ACTIVE)
+    if (!selectMemorySource())
         return;
 
     /* Build the memory region flag variable */
@@ -253,6 +310,9 @@ void RamSearchWindow::slotNew()
 
 void RamSearchWindow::slotSearch()
 {
+    if (!selectMemorySource())
+        return;
+
     CompareType compare_type;
     CompareOperator compare_operator;
     double compare_value;
@@ -271,6 +331,46 @@ void RamSearchWindow::slotSearch()
 
 }
 
+void RamSearchWindow::slotRecord()
+{
+    if (ramSearchModel->history.isRecording()) {
+        ramSearchModel->history.stop();
+        recordButton->setText(tr("Start Recording"));
+        historyLabel->setText(QString("%1 frames recorded (%2 kB)").arg(ramSearchModel->history.frameCount()).arg(ramSearchModel->history.memorySize() / 1024));
+        return;
+    }
+
+    if (context->status != Context::ACTIVE)
+        return;
+
+    if (ramSearchModel->watchCount() == 0) {
+        QMessageBox::critical(nullptr, "Error", QString("You must start a search before recording the candidates"));
+        return;
+    }
+
+    ramSearchModel->startHistory();
+    recordButton->setText(tr("Stop Recording"));
+    historyLabel->setText(tr("0 frames recorded"));
+}
+
+void RamSearchWindow::slotSearchHistory()
+{
+    CompareType compare_type;
+    CompareOperator compare_operator;
+    double compare_value;
+    getCompareParameters(compare_type, compare_operator, compare_value);
+
+    MemoryHistory::QueryMode mode = MemoryHistory::QueryAll;
+    if (historyModeBox->currentIndex() == 1)
+        mode = MemoryHistory::QueryAtLeast;
+    if (historyModeBox->currentIndex() == 2)
+        mode = MemoryHistory::QueryRun;
+
+    ramSearchModel->searchHistory(compare_type, compare_operator, compare_value, mode, historyFramesBox->value());
+
+    watchCount->setText(QString("%1 addresses").arg(ramSearchModel->watchCount()));
+}
+
 void RamSearchWindow::slotAdd()
 {
     const QModelIndex index = ramSearchView->selectionModel()->currentIndex();
@@ -288,7 +388,7 @@ void RamSearchWindow::slotAdd()
 
     MainWindow *mw = qobject_cast<MainWindow*>(parent());
     if (mw) {
-        mw->ramWatchWindow->editWindow->fill(ramSearchModel->ramwatches.at(row));
+        mw->ramWatchWindow->editWindow->fill(ramSearchModel->watchAt(row));
         mw->ramWatchWindow->slotAdd();
     }
 }
@@ -28,6 +28,8 @@
 #include <QComboBox>
 #include <QProgressBar>
 #include <QLabel>
+#include <QPushButton>
+#include <QSpinBox>
 #include <memory>
 
 #include "RamSearchModel.h"
@@ -41,6 +43,9 @@ public:
 
     void update();
 
+    /* Record the memory history, called from the game loop thread */
+    void recordHistory(unsigned long long framecount);
+
 private:
     Context *context;
     QTableView *ramSearchView;
@@ -71,15 +76,26 @@ private:
     QRadioButton *operatorLessEqualButton;
     QRadioButton *operatorGreaterEqualButton;
 
+    QPushButton *recordButton;
+    QComboBox *historyModeBox;
+    QSpinBox *historyFramesBox;
+    QLabel *historyLabel;
+
+    QComboBox *sourceBox;
     QComboBox *typeBox;
     QComboBox *displayBox;
 
+    /* Set the memory source of the search from the source box */
+    bool selectMemorySource();
+
     void getCompareParameters(CompareType& compare_type, CompareOperator& compare_operator, double& compare_value);
 
 private slots:
     void slotNew();
     void slotSearch();
     void slotAdd();
+    void slotRecord();
+    void slotSearchHistory();
 
 };
 
@@ -0,0 +1,111 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SharedConfig.h"
+#include "sockethelpers.h"
+
+#include <cstddef> // offsetof
+#include <cstring>
+#include <vector>
+
+#ifdef SOCKET_LOG
+#include "../library/logging.h"
+#else
+#include <iostream>
+#endif
+
+struct FieldInfo {
+    size_t offset;
+    size_t size;
+};
+
+static const FieldInfo field_infos[SCF_NUM_FIELDS] = {
+#define SHAREDCONFIG_FIELD_INFO(field) {offsetof(SharedConfig, field), sizeof(SharedConfig::field)},
+    SHAREDCONFIG_FIELDS(SHAREDCONFIG_FIELD_INFO)
+#undef SHAREDCONFIG_FIELD_INFO
+};
+
+/* Check that no field was forgotten in the list. The struct is packed, so
+ * its fields end exactly at the end of its last member, which must be
+ * time_trace. Only the final padding up to 8 bytes follows. */
+#define SHAREDCONFIG_FIELD_SIZE(field) + sizeof(SharedConfig::field)
+static_assert((0 SHAREDCONFIG_FIELDS(SHAREDCONFIG_FIELD_SIZE)) ==
+    offsetof(SharedConfig, time_trace) + sizeof(SharedConfig::time_trace),
+    "A SharedConfig field is missing from SHAREDCONFIG_FIELDS");
+static_assert(offsetof(SharedConfig, time_trace) + sizeof(SharedConfig::time_trace) + 8 > sizeof(SharedConfig),
+    "time_trace must be the last member of SharedConfig");
+#undef SHAREDCONFIG_FIELD_SIZE
+
+void sendSharedConfigDelta(const SharedConfig& sc, SharedConfig& prev)
+{
+    const char* cur_data = reinterpret_cast<const char*>(&sc);
+    char* prev_data = reinterpret_cast<char*>(&prev);
+
+    /* Build the list of modified fields first, because the count is sent
+     * before the fields */
+    uint16_t modified[SCF_NUM_FIELDS];
+    uint32_t count = 0;
+    for (uint16_t id = 0; id < SCF_NUM_FIELDS; id++) {
+        const FieldInfo& fi = field_infos[id];
+        if (memcmp(cur_data + fi.offset, prev_data + fi.offset, fi.size) != 0)
+            modified[count++] = id;
+    }
+
+    sendData(&count, sizeof(uint32_t));
+    for (uint32_t i = 0; i < count; i++) {
+        const FieldInfo& fi = field_infos[modified[i]];
+        uint16_t size = fi.size;
+        sendData(&modified[i], sizeof(uint16_t));
+        sendData(&size, sizeof(uint16_t));
+        sendData(cur_data + fi.offset, fi.size);
+        memcpy(prev_data + fi.offset, cur_data + fi.offset, fi.size);
+    }
+}
+
+void receiveSharedConfigDelta(SharedConfig& sc)
+{
+    /* Apply the fields to a copy, so that the config is never observed
+     * partially updated */
+    SharedConfig new_sc = sc;
+    char* data = reinterpret_cast<char*>(&new_sc);
+
+    uint32_t count;
+    receiveData(&count, sizeof(uint32_t));
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t id, size;
+        receiveData(&id, sizeof(uint16_t));
+        receiveData(&size, sizeof(uint16_t));
+
+        if ((id < SCF_NUM_FIELDS) && (field_infos[id].size == size)) {
+            receiveData(data + field_infos[id].offset, size);
+        }
+        else {
+            /* Unknown field, skip it */
+#ifdef SOCKET_LOG
+            libtas::debuglogstdio(LCF_SOCKET | LCF_ERROR, "Unknown config field %d of size %d", id, size);
+#else
+            std::cerr << "Unknown config field " << id << " of size " << size << std::endl;
+#endif
+            std::vector<char> skipped(size);
+            receiveData(skipped.data(), size);
+        }
+    }
+
+    sc = new_sc;
+}
@@ -117,6 +117,30 @@ struct __attribute__((packed, aligned(8))) SharedConfig {
     int audio_codec = 0;
     int audio_bitrate = 128;
 
+    /* Pixel format of the frames sent to the encoder. Frames can be
+     * converted to YUV by the game process, which divides the amount of data
+     * sent to ffmpeg.
+     */
+    enum EncodePixelFormat {
+        ENCODE_PIXFMT_NATIVE,
+        ENCODE_PIXFMT_YUV420P,
+        ENCODE_PIXFMT_NV12,
+    };
+    int video_pixfmt = ENCODE_PIXFMT_NATIVE;
+
+    /* Integer factor by which frames are downscaled before encoding */
+    int video_downscale = 1;
+
+    /* How frames are encoded: through a pipe to an ffmpeg process, by
+     * libavcodec inside the game process, or losslessly into a libTAS
+     * capture file that is transcoded later */
+    enum EncodeBackend {
+        ENCODE_BACKEND_PIPE,
+        ENCODE_BACKEND_LIBAV,
+        ENCODE_BACKEND_CAPTURE,
+    };
+    int encode_backend = ENCODE_BACKEND_PIPE;
+
     /* An enum indicating which time-getting function query the time */
     enum TimeCallType
     {
@@ -295,8 +319,89 @@ struct __attribute__((packed, aligned(8))) SharedConfig {
     /* User can modify the framerate during the game execution */
     bool variable_framerate = false;
 
-    /* Send stack traces of all time calls to libTAS program */
+    /* Send stack traces of all time calls to libTAS program.
+     * Must stay the last member, see SharedConfig.cpp */
     bool time_trace = false;
 };
 
+/* List of all SharedConfig fields. The position of a field in this list is
+ * its identifier when sending a config delta, so new fields must be appended
+ * at the end of the list. */
+#define SHAREDCONFIG_FIELDS(X) \
+    X(speed_divisor) \
+    X(fastforward_mode) \
+    X(recording) \
+    X(movie_framecount) \
+    X(initial_framecount) \
+    X(logging_status) \
+    X(includeFlags) \
+    X(excludeFlags) \
+    X(framerate_num) \
+    X(framerate_den) \
+    X(nb_controllers) \
+    X(osd) \
+    X(osd_frame_location) \
+    X(osd_inputs_location) \
+    X(osd_messages_location) \
+    X(osd_ramwatches_location) \
+    X(audio_bitdepth) \
+    X(audio_channels) \
+    X(audio_frequency) \
+    X(video_codec) \
+    X(video_bitrate) \
+    X(video_framerate) \
+    X(audio_codec) \
+    X(audio_bitrate) \
+    X(main_gettimes_threshold) \
+    X(sec_gettimes_threshold) \
+    X(initial_time_sec) \
+    X(initial_time_nsec) \
+    X(screen_width) \
+    X(screen_height) \
+    X(debug_state) \
+    X(locale) \
+    X(async_events) \
+    X(wait_timeout) \
+    X(game_specific_timing) \
+    X(game_specific_sync) \
+    X(savestate_settings) \
+    X(busy_loop_hash) \
+    X(running) \
+    X(fastforward) \
+    X(av_dumping) \
+    X(keyboard_support) \
+    X(mouse_support) \
+    X(mouse_mode_relative) \
+    X(osd_encode) \
+    X(prevent_savefiles) \
+    X(write_savefiles_on_exit) \
+    X(audio_mute) \
+    X(audio_disabled) \
+    X(save_screenpixels) \
+    X(recycle_threads) \
+    X(virtual_steam) \
+    X(opengl_soft) \
+    X(opengl_performance) \
+    X(busyloop_detection) \
+    X(variable_framerate) \
+    X(time_trace) \
+    X(video_pixfmt) \
+    X(video_downscale) \
+    X(encode_backend)
+
+enum SharedConfigField {
+#define SHAREDCONFIG_FIELD_ID(field) SCF_##field,
+    SHAREDCONFIG_FIELDS(SHAREDCONFIG_FIELD_ID)
+#undef SHAREDCONFIG_FIELD_ID
+    SCF_NUM_FIELDS
+};
+
+/* Send the fields of `sc` that differ from `prev` over the socket, and update
+ * `prev` to the sent config. Must be preceded by a MSGN_CONFIG_DELTA message.
+ */
+void sendSharedConfigDelta(const SharedConfig& sc, SharedConfig& prev);
+
+/* Receive a config delta and apply all of its fields at once to `sc` */
+void receiveSharedConfigDelta(SharedConfig& sc);
+
 #endif
@@ -245,6 +245,14 @@ enum {
      */
     MSGB_GETTIME_BACKTRACE,
 
+    /*
+     * Send only the fields of the config that were modified since the last
+     * sent config.
+     * Argument: uint32_t (field count) then for each field: uint16_t (field
+     * id), uint16_t (field size), field data
+     */
+    MSGN_CONFIG_DELTA,
+
 };
 
 #endif
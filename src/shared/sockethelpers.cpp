@@ -26,6 +26,8 @@
 #include <iostream>
 #include <vector>
 #include <mutex>
+#include <cstring>
+#include <algorithm>
 
 #ifdef SOCKET_LOG
 #include "lcf.h"
@@ -41,13 +43,47 @@ static int socket_fd = 0;
 
 static std::mutex mutex;
 
+/* Outgoing data is accumulated between beginSendBatch() and endSendBatch(),
+ * so that all the messages of a frame boundary are sent in one syscall */
+static std::vector<char> send_buffer;
+static bool send_batching = false;
+
+/* Data that was received from the socket but not consumed yet. Small
+ * receives fill this buffer with everything that is available, so that
+ * the following receives do not need a syscall.
+ * On the game side, this buffer is part of the savestates. This is fine
+ * because the program always waits for an answer after asking for a
+ * save or load, so the buffer is empty when the state is saved and when
+ * it is restored. */
+static char recv_buffer[64*1024];
+static size_t recv_start = 0;
+static size_t recv_end = 0;
+
+/* The socket path can be changed with the LIBTAS_SOCKET environment
+ * variable, so that several instances of libTAS can run at the same time */
+static const char* socketFilename(void)
+{
+    const char* filename = getenv("LIBTAS_SOCKET");
+    return filename ? filename : SOCKET_FILENAME;
+}
+
+/* Build the socket address */
+static struct sockaddr_un socketAddress(void)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketFilename(), sizeof(addr.sun_path) - 1);
+    return addr;
+}
+
 void removeSocket(void){
-    unlink(SOCKET_FILENAME);
+    unlink(socketFilename());
 }
 
 bool initSocketProgram(void)
 {
-    const struct sockaddr_un addr = { AF_UNIX, SOCKET_FILENAME };
+    const struct sockaddr_un addr = socketAddress();
     socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
 
     struct timespec tim = {0, 500L*1000L*1000L};
@@ -78,11 +114,11 @@ bool initSocketGame(void)
      * In this case, we just return immediately.
      */
     struct stat st;
-    int result = stat(SOCKET_FILENAME, &st);
+    int result = stat(socketFilename(), &st);
     if (result == 0)
         return false;
 
-    const struct sockaddr_un addr = { AF_UNIX, SOCKET_FILENAME };
+    const struct sockaddr_un addr = socketAddress();
     const int tmp_fd = socket(AF_UNIX, SOCK_STREAM, 0);
     if (bind(tmp_fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(struct sockaddr_un)))
     {
@@ -109,6 +145,17 @@ bool initSocketGame(void)
 void closeSocket(void)
 {
     close(socket_fd);
+
+    /* Discard any pending data */
+    send_buffer.clear();
+    send_batching = false;
+    recv_start = 0;
+    recv_end = 0;
+}
+
+int getSocketFd(void)
+{
+    return socket_fd;
 }
 
 void lockSocket(void)
@@ -121,12 +168,8 @@ void unlockSocket(void)
     mutex.unlock();
 }
 
-void sendData(const void* elem, unsigned int size)
+static void sendRaw(const void* elem, unsigned int size)
 {
-#ifdef SOCKET_LOG
-    libtas::debuglogstdio(LCF_SOCKET, "Send socket data of size %u", size);
-#endif
-
     ssize_t ret = 0;
     do {
         ret = send(socket_fd, elem, size, 0);
@@ -148,6 +191,41 @@ void sendData(const void* elem, unsigned int size)
     }
 }
 
+void sendData(const void* elem, unsigned int size)
+{
+#ifdef SOCKET_LOG
+    libtas::debuglogstdio(LCF_SOCKET, "Send socket data of size %u", size);
+#endif
+
+    if (send_batching) {
+        const char* data = static_cast<const char*>(elem);
+        send_buffer.insert(send_buffer.end(), data, data + size);
+        return;
+    }
+
+    sendRaw(elem, size);
+}
+
+void beginSendBatch(void)
+{
+    send_batching = true;
+}
+
+void endSendBatch(void)
+{
+    send_batching = false;
+
+    if (send_buffer.empty())
+        return;
+
+#ifdef SOCKET_LOG
+    libtas::debuglogstdio(LCF_SOCKET, "Send socket batch of size %zu", send_buffer.size());
+#endif
+
+    sendRaw(send_buffer.data(), send_buffer.size());
+    send_buffer.clear();
+}
+
 void sendMessage(int message)
 {
 #ifdef SOCKET_LOG
@@ -172,26 +250,59 @@ int receiveData(void* elem, unsigned int size)
     libtas::debuglogstdio(LCF_SOCKET, "Receive socket data of size %u", size);
 #endif
 
-    ssize_t ret = 0;
-    do {
-        ret = recv(socket_fd, elem, size, MSG_WAITALL);
-    } while ((ret == -1) && (errno == EINTR));
+    char* dest = static_cast<char*>(elem);
+    unsigned int received = 0;
+
+    while (received < size) {
+        /* Consume buffered data first */
+        if (recv_start < recv_end) {
+            size_t n = std::min(static_cast<size_t>(size - received), recv_end - recv_start);
+            memcpy(dest + received, recv_buffer + recv_start, n);
+            recv_start += n;
+            received += n;
+            continue;
+        }
 
-    if (ret == -1) {
+        ssize_t ret = 0;
+        if ((size - received) >= sizeof(recv_buffer)) {
+            /* Large data, receive it directly */
+            do {
+                ret = recv(socket_fd, dest + received, size - received, MSG_WAITALL);
+            } while ((ret == -1) && (errno == EINTR));
+        }
+        else {
+            /* Get everything available, or block until something arrives */
+            do {
+                ret = recv(socket_fd, recv_buffer, sizeof(recv_buffer), 0);
+            } while ((ret == -1) && (errno == EINTR));
+        }
+
+        if (ret == -1) {
 #ifdef SOCKET_LOG
-        libtas::debuglogstdio(LCF_SOCKET | LCF_ERROR, "recv() returns -1 with error %s", strerror(errno));
+            libtas::debuglogstdio(LCF_SOCKET | LCF_ERROR, "recv() returns -1 with error %s", strerror(errno));
 #else
-        std::cerr << "recv() returns -1 with error " << strerror(errno) << std::endl;
+            std::cerr << "recv() returns -1 with error " << strerror(errno) << std::endl;
 #endif
-    }
-    else if (ret != size) {
+            return -1;
+        }
+        if (ret == 0) {
 #ifdef SOCKET_LOG
-        libtas::debuglogstdio(LCF_SOCKET | LCF_ERROR, "recv() %u bytes instead of %u", ret, size);
+            libtas::debuglogstdio(LCF_SOCKET | LCF_ERROR, "recv() %u bytes instead of %u", received, size);
 #else
-        std::cerr << "recv() " << ret << " bytes instead of " << size << std::endl;
+            std::cerr << "recv() " << received << " bytes instead of " << size << std::endl;
 #endif
+            return received;
+        }
+
+        if ((size - received) >= sizeof(recv_buffer)) {
+            received += ret;
+        }
+        else {
+            recv_start = 0;
+            recv_end = ret;
+        }
     }
-    return ret;
+    return received;
 }
 
 int receiveMessage()
@@ -209,8 +320,18 @@ int receiveMessage()
 
 int receiveMessageNonBlocking()
 {
+    if (recv_start == recv_end) {
+        /* Check if something is available without blocking */
+        ssize_t ret = recv(socket_fd, recv_buffer, sizeof(recv_buffer), MSG_DONTWAIT);
+        if (ret <= 0)
+            return -1;
+        recv_start = 0;
+        recv_end = ret;
+    }
+
+    /* A message has started to arrive, get the full message */
     int msg;
-    int ret = recv(socket_fd, &msg, sizeof(int), MSG_WAITALL | MSG_DONTWAIT);
+    int ret = receiveData(&msg, sizeof(int));
     if (ret < 0)
         return ret;
 #ifdef SOCKET_LOG
@@ -35,6 +35,9 @@ bool initSocketGame(void);
 /* Close the socket connection */
 void closeSocket(void);
 
+/* Get the file descriptor of the socket, to be used with poll/epoll */
+int getSocketFd(void);
+
 /* Lock access to socket */
 void lockSocket(void);
 
@@ -46,6 +49,15 @@ void unlockSocket(void);
  */
 void sendData(const void* elem, unsigned int size);
 
+/* Start accumulating the data sent over the socket instead of sending it
+ * right away. Must be called with the socket locked if other threads may
+ * also send data.
+ */
+void beginSendBatch(void);
+
+/* Send all the data accumulated since beginSendBatch() in a single call */
+void endSendBatch(void);
+
 /* Send a string object through the socket. It first sends the string length,
  * followed by the char array.
  */
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+# This script transcodes a lossless capture file written by libTAS (.ltcap)
+# with ffmpeg. It requires the lz4 and numpy python modules.
+# Run ./ltcap2ffmpeg.py capture.ltcap output.mkv [ffmpeg options]
+
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+import lz4.block
+import numpy as np
+
+HEADER = struct.Struct('<8sIII4sIIIIIIIIQQQ')
+RECORD = struct.Struct('<IIQ')
+INDEX = struct.Struct('<IIQQ')
+
+VIDEO_RECORD = 0
+AUDIO_RECORD = 1
+
+PIXFMTS = {
+    b'RGBA': 'rgba', b'BGRA': 'bgra', b'ABGR': 'abgr', b'ARGB': 'argb',
+    b'RGB\0': 'rgb0', b'BGR\0': 'bgr0', b'\0RGB': '0rgb', b'\0BGR': '0bgr',
+    b'RAW ': 'rgb24', b'24BG': 'bgr24', b'I420': 'yuv420p', b'NV12': 'nv12',
+}
+
+if len(sys.argv) < 3:
+    print('Usage: ltcap2ffmpeg.py capture.ltcap output [ffmpeg options]')
+    sys.exit(1)
+
+capture = open(sys.argv[1], 'rb')
+(magic, version, width, height, pixfmt, frame_size, stride, bands, fpsnum,
+    fpsden, samplerate, bitdepth, channels, video_frames, index_offset,
+    index_count) = HEADER.unpack(capture.read(HEADER.size))
+
+if magic != b'LTASCAP\0' or version != 1:
+    sys.exit('Not a libTAS capture file')
+if index_offset == 0:
+    sys.exit('The capture was not finished, the index is missing')
+
+capture.seek(index_offset)
+index = [INDEX.unpack(capture.read(INDEX.size)) for i in range(index_count)]
+
+def decode_frame(payload):
+    sizes = struct.unpack_from('<%dI' % bands, payload)
+    pos = 4 * bands
+    frame = bytearray()
+    for band, size in enumerate(sizes):
+        band_len = frame_size * (band + 1) // bands - frame_size * band // bands
+        data = lz4.block.decompress(payload[pos:pos+size], uncompressed_size=band_len)
+        pos += size
+
+        # Undo the prediction from the byte `stride` bytes before
+        rows = -(-band_len // stride)
+        plane = np.zeros(rows * stride, dtype=np.uint8)
+        plane[:band_len] = np.frombuffer(data, dtype=np.uint8)
+        plane = np.cumsum(plane.reshape(rows, stride), axis=0, dtype=np.uint8)
+        frame += plane.tobytes()[:band_len]
+    return bytes(frame)
+
+# Audio is written to a temporary file that is given as a second input
+audio_file = tempfile.NamedTemporaryFile(suffix='.raw', delete=False)
+for record_type, size, pts, offset in index:
+    if record_type == AUDIO_RECORD:
+        capture.seek(offset + RECORD.size)
+        audio_file.write(capture.read(size))
+audio_file.close()
+
+command = ['ffmpeg', '-hide_banner', '-y',
+    '-f', 'rawvideo', '-pix_fmt', PIXFMTS[pixfmt], '-s', '%dx%d' % (width, height),
+    '-framerate', '%d/%d' % (fpsnum, fpsden), '-i', '-',
+    '-f', 's16le' if bitdepth == 16 else 'u8', '-ar', str(samplerate),
+    '-ac', str(channels), '-i', audio_file.name]
+command += sys.argv[3:] + [sys.argv[2]]
+ffmpeg = subprocess.Popen(command, stdin=subprocess.PIPE)
+
+# Frames are repeated until the pts of the next frame
+video = [entry for entry in index if entry[0] == VIDEO_RECORD]
+for i, (record_type, size, pts, offset) in enumerate(video):
+    next_pts = video[i+1][2] if i + 1 < len(video) else video_frames
+    capture.seek(offset + RECORD.size)
+    frame = decode_frame(capture.read(size))
+    for repeat in range(next_pts - pts):
+        ffmpeg.stdin.write(frame)
+
+ffmpeg.stdin.close()
+ret = ffmpeg.wait()
+os.unlink(audio_file.name)
+sys.exit(ret)